@@ -0,0 +1,23 @@
+#include "core/accelerator.hpp"
+
+using namespace geometry;
+
+namespace core {
+
+bool accelerator::intersection::has_hit() const {
+	return distance >= 0;
+}
+
+std::array<accelerator::intersection, packet_size> accelerator::intersect_packet(
+		const ray_packet &rays, int mask) const {
+	std::array<intersection, packet_size> hits;
+
+	for (uint8_t i = 0; i < packet_size; i++) {
+		if (mask & (1 << i))
+			hits[i] = intersect(rays[i]);
+	}
+
+	return hits;
+}
+
+}
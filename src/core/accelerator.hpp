@@ -0,0 +1,46 @@
+#pragma once
+
+#include "pch.hpp"
+
+#include "geometry/ray.hpp"
+#include "geometry/ray_packet.hpp"
+#include "math/vec3.hpp"
+
+namespace core {
+
+enum class accelerator_type {
+	kd_tree,
+	bvh
+};
+
+// Acceleration structure over the triangles of a single mesh
+class accelerator {
+public:
+	struct intersection {
+		float distance = -1;
+		math::fvec3 barycentric;
+		uint32_t index;
+
+		bool has_hit() const;
+	};
+
+	virtual ~accelerator() {}
+
+	// Index is the position of the triangle in the mesh
+	virtual intersection intersect(const geometry::ray &ray, uint8_t visualize_depth = 0) const = 0;
+
+	// Returns on the first hit closer than max_distance, whichever one it is
+	virtual bool occluded(const geometry::ray &ray, float max_distance) const = 0;
+
+	// Only rays enabled in the mask are traced, by default one by one
+	virtual std::array<intersection, geometry::packet_size> intersect_packet(
+			const geometry::ray_packet &rays, int mask) const;
+
+	// Writes the built structure as raw arrays, so that load() only has to copy them back
+	virtual void save(std::ostream &stream) const = 0;
+
+	// Throws if the data is truncated
+	virtual void load(std::span<const std::byte> data) = 0;
+};
+
+}
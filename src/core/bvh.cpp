@@ -0,0 +1,170 @@
+#include "core/bvh.hpp"
+
+#include "math/math.hpp"
+
+using namespace geometry;
+using namespace math;
+
+namespace core {
+
+namespace bvh_builder {
+
+struct bin {
+	geometry::aabb aabb;
+	uint32_t count = 0;
+};
+
+// Relative cost of visiting a node compared to testing a primitive
+static constexpr float traversal_cost = 0.125F;
+
+static uint32_t init_node(
+		bvh &bvh,
+		const std::vector<aabb> &bounds,
+		const std::vector<fvec3> &centroids,
+		uint32_t begin, uint32_t end,
+		uint32_t bin_count, uint32_t max_leaf_size,
+		uint8_t depth) {
+	uint32_t node_index = bvh.nodes.size();
+	bvh.nodes.emplace_back();
+
+	geometry::aabb aabb, centroid_aabb;
+	aabb.clear();
+	centroid_aabb.clear();
+
+	for (uint32_t i = begin; i < end; i++) {
+		aabb.add(bounds[bvh.indices[i]]);
+		centroid_aabb.add(centroids[bvh.indices[i]]);
+	}
+
+	uint32_t count = end - begin;
+
+	bvh.nodes[node_index].aabb = aabb;
+	bvh.nodes[node_index].offset = begin;
+	bvh.nodes[node_index].count = count;
+
+	// Create leaf node once we've reached maximum depth
+	if (count == 1 || depth == bvh::max_depth - 1)
+		return node_index;
+
+	// Bin along the axis with the widest centroid spread
+	fvec3 widths = centroid_aabb.max - centroid_aabb.min;
+	uint8_t axis = std::max_element(&widths.x,
+			&widths.x + 3) - &widths.x;
+
+	uint32_t mid;
+
+	if (widths[axis] > 0) {
+		std::vector<bin> bins(bin_count);
+		for (bin &bin : bins)
+			bin.aabb.clear();
+
+		float scale = bin_count / widths[axis];
+		auto get_bin = [&] (uint32_t index) {
+			float offset = centroids[index][axis] - centroid_aabb.min[axis];
+			return math::min(static_cast<uint32_t>(offset * scale), bin_count - 1);
+		};
+
+		for (uint32_t i = begin; i < end; i++) {
+			bin &bin = bins[get_bin(bvh.indices[i])];
+			bin.aabb.add(bounds[bvh.indices[i]]);
+			bin.count++;
+		}
+
+		// Sweep from the right to accumulate right side costs
+		std::vector<float> rcosts(bin_count);
+		{
+			geometry::aabb raabb;
+			raabb.clear();
+			uint32_t rcount = 0;
+
+			for (uint32_t i = bin_count - 1; i > 0; i--) {
+				if (bins[i].count > 0) {
+					raabb.add(bins[i].aabb);
+					rcount += bins[i].count;
+				}
+				rcosts[i] = rcount > 0 ? rcount * raabb.get_surface_area() : -1;
+			}
+		}
+
+		// Then sweep from the left and evaluate every split
+		float best_cost = std::numeric_limits<float>::max();
+		uint32_t best_split = 0;
+		{
+			geometry::aabb laabb;
+			laabb.clear();
+			uint32_t lcount = 0;
+
+			for (uint32_t i = 0; i < bin_count - 1; i++) {
+				if (bins[i].count > 0) {
+					laabb.add(bins[i].aabb);
+					lcount += bins[i].count;
+				}
+
+				if (lcount == 0 || rcosts[i + 1] < 0)
+					continue;
+
+				float cost = lcount * laabb.get_surface_area() + rcosts[i + 1];
+				if (cost < best_cost) {
+					best_cost = cost;
+					best_split = i;
+				}
+			}
+		}
+
+		best_cost = traversal_cost + best_cost / aabb.get_surface_area();
+
+		if (count <= max_leaf_size && count <= best_cost)
+			return node_index;
+
+		auto it = std::partition(
+				bvh.indices.begin() + begin,
+				bvh.indices.begin() + end,
+				[&] (uint32_t index) { return get_bin(index) <= best_split; });
+
+		mid = it - bvh.indices.begin();
+	} else {
+		// All centroids overlap, so split the range in half
+		if (count <= max_leaf_size)
+			return node_index;
+
+		mid = begin + count / 2;
+	}
+
+	bvh.nodes[node_index].axis = axis;
+	bvh.nodes[node_index].count = 0;
+
+	init_node(bvh, bounds, centroids, begin, mid,
+			bin_count, max_leaf_size, depth + 1);
+	uint32_t right = init_node(bvh, bounds, centroids, mid, end,
+			bin_count, max_leaf_size, depth + 1);
+
+	bvh.nodes[node_index].offset = right;
+
+	return node_index;
+}
+
+}
+
+void bvh::build(const std::vector<aabb> &bounds,
+		uint32_t bin_count, uint32_t max_leaf_size) {
+	nodes.clear();
+	indices.resize(bounds.size());
+	std::iota(indices.begin(), indices.end(), 0);
+
+	if (bounds.empty())
+		return;
+
+	std::vector<fvec3> centroids;
+	centroids.reserve(bounds.size());
+	for (const aabb &aabb : bounds)
+		centroids.push_back((aabb.min + aabb.max) * 0.5F);
+
+	nodes.reserve(bounds.size() * 2);
+
+	bvh_builder::init_node(*this, bounds, centroids,
+			0, bounds.size(), bin_count, max_leaf_size, 0);
+
+	nodes.shrink_to_fit();
+}
+
+}
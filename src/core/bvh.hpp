@@ -0,0 +1,48 @@
+#pragma once
+
+#include "pch.hpp"
+
+#include "geometry/aabb.hpp"
+#include "geometry/ray.hpp"
+#include "math/vec3.hpp"
+
+namespace core {
+
+// Nodes are laid out depth-first, so the left child of a branch directly follows it
+struct bvh_node {
+	geometry::aabb aabb;
+	uint32_t offset; // Right child of a branch or first index of a leaf
+	uint16_t count;  // Index count, zero for branches
+	uint8_t axis;    // Split axis of a branch
+};
+
+// Binary BVH built over arbitrary primitive bounds
+class bvh {
+public:
+	// Traversal uses a fixed-size stack
+	static constexpr uint8_t max_depth = 64;
+
+	std::vector<bvh_node> nodes;
+
+	// Primitive indices in leaf order
+	std::vector<uint32_t> indices;
+
+	void build(const std::vector<geometry::aabb> &bounds,
+			uint32_t bin_count = 16, uint32_t max_leaf_size = 4);
+
+	// Visits leaves front-to-back and calls intersector(index) for each of their primitives
+	// The intersector may shrink max_distance and returns true to stop the traversal
+	template<typename Intersector>
+	void intersect(const geometry::ray &ray, float &max_distance, Intersector &&intersector) const;
+
+private:
+	static bool intersect_aabb(
+			const geometry::aabb &aabb,
+			const math::fvec3 &origin,
+			const math::fvec3 &inv_dir,
+			float max_distance);
+};
+
+}
+
+#include "bvh.inl"
@@ -0,0 +1,64 @@
+namespace core {
+
+template<typename Intersector>
+void bvh::intersect(const geometry::ray &ray, float &max_distance, Intersector &&intersector) const {
+	if (nodes.empty())
+		return;
+
+	math::fvec3 dir = ray.get_dir();
+	math::fvec3 inv_dir = math::fvec3::one / dir;
+	bool dir_is_neg[3] = { dir.x < 0, dir.y < 0, dir.z < 0 };
+
+	std::array<uint32_t, max_depth> stack;
+	size_t stack_size = 0;
+	uint32_t node_index = 0;
+
+	while (true) {
+		const bvh_node &node = nodes[node_index];
+
+		if (intersect_aabb(node.aabb, ray.origin, inv_dir, max_distance)) {
+			if (node.count > 0) {
+				for (uint32_t i = 0; i < node.count; i++) {
+					if (intersector(indices[node.offset + i]))
+						return;
+				}
+			} else {
+				// Visit the nearer child first
+				if (dir_is_neg[node.axis]) {
+					stack[stack_size++] = node_index + 1;
+					node_index = node.offset;
+				} else {
+					stack[stack_size++] = node.offset;
+					node_index = node_index + 1;
+				}
+				continue;
+			}
+		}
+
+		if (stack_size == 0)
+			break;
+
+		node_index = stack[--stack_size];
+	}
+}
+
+inline bool bvh::intersect_aabb(
+		const geometry::aabb &aabb,
+		const math::fvec3 &origin,
+		const math::fvec3 &inv_dir,
+		float max_distance) {
+	math::fvec3 min_distances = (aabb.min - origin) * inv_dir;
+	math::fvec3 max_distances = (aabb.max - origin) * inv_dir;
+
+	math::fvec3 near_distances = math::min(min_distances, max_distances);
+	math::fvec3 far_distances = math::max(min_distances, max_distances);
+
+	float near = math::max(near_distances.x,
+			near_distances.y, near_distances.z, 0.0F);
+	float far = math::min(far_distances.x,
+			far_distances.y, far_distances.z, max_distance);
+
+	return near <= far;
+}
+
+}
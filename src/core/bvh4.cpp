@@ -0,0 +1,105 @@
+#include "core/bvh4.hpp"
+
+using namespace geometry;
+using namespace math;
+
+namespace core {
+
+namespace bvh4_builder {
+
+static bvh4_node make_empty_node() {
+	// Padding included, since nodes are written to the accelerator cache as they are
+	bvh4_node node;
+	std::memset(&node, 0, sizeof(node));
+
+	for (uint8_t slot = 0; slot < 4; slot++) {
+		for (uint8_t axis = 0; axis < 3; axis++) {
+			node.bounds[axis][slot]     = std::numeric_limits<float>::infinity();
+			node.bounds[axis + 3][slot] = -std::numeric_limits<float>::infinity();
+		}
+
+		node.offsets[slot] = 0;
+		node.counts[slot] = 0;
+	}
+
+	node.axes[0] = node.axes[1] = node.axes[2] = 0;
+
+	return node;
+}
+
+static uint32_t init_node(bvh4 &bvh4, const bvh &bvh, uint32_t binary_index);
+
+static void init_slot(
+		bvh4 &bvh4, uint32_t node_index, uint8_t slot,
+		const bvh &bvh, uint32_t binary_index) {
+	const bvh_node &binary = bvh.nodes[binary_index];
+
+	uint32_t offset = binary.count > 0 ? binary.offset :
+			init_node(bvh4, bvh, binary_index);
+
+	// The node might have been reallocated in the meantime
+	bvh4_node &node = bvh4.nodes[node_index];
+
+	for (uint8_t axis = 0; axis < 3; axis++) {
+		node.bounds[axis][slot]     = binary.aabb.min[axis];
+		node.bounds[axis + 3][slot] = binary.aabb.max[axis];
+	}
+
+	node.offsets[slot] = offset;
+	node.counts[slot] = binary.count;
+}
+
+// Pulls the grandchildren of a binary branch into a single node
+// A child that is a leaf takes the first slot of its pair and leaves the second one empty
+static uint32_t init_node(bvh4 &bvh4, const bvh &bvh, uint32_t binary_index) {
+	uint32_t node_index = bvh4.nodes.size();
+	bvh4.nodes.push_back(make_empty_node());
+
+	const bvh_node &binary = bvh.nodes[binary_index];
+	bvh4.nodes[node_index].axes[0] = binary.axis;
+
+	uint32_t children[2] = { binary_index + 1, binary.offset };
+
+	for (uint8_t i = 0; i < 2; i++) {
+		const bvh_node &child = bvh.nodes[children[i]];
+
+		if (child.count > 0) {
+			init_slot(bvh4, node_index, i * 2, bvh, children[i]);
+			continue;
+		}
+
+		bvh4.nodes[node_index].axes[1 + i] = child.axis;
+		init_slot(bvh4, node_index, i * 2, bvh, children[i] + 1);
+		init_slot(bvh4, node_index, i * 2 + 1, bvh, child.offset);
+	}
+
+	return node_index;
+}
+
+}
+
+void bvh4::build(const std::vector<aabb> &bounds,
+		uint32_t bin_count, uint32_t max_leaf_size) {
+	nodes.clear();
+
+	core::bvh binary;
+	binary.build(bounds, bin_count, max_leaf_size);
+
+	indices = std::move(binary.indices);
+
+	if (binary.nodes.empty())
+		return;
+
+	nodes.reserve(binary.nodes.size() / 2 + 1);
+
+	// A single leaf still needs a node to live in
+	if (binary.nodes.front().count > 0) {
+		nodes.push_back(bvh4_builder::make_empty_node());
+		bvh4_builder::init_slot(*this, 0, 0, binary, 0);
+	} else
+		bvh4_builder::init_node(*this, binary, 0);
+
+	nodes.shrink_to_fit();
+}
+
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "pch.hpp"
+
+#include "core/bvh.hpp"
+#include "geometry/aabb.hpp"
+#include "geometry/ray.hpp"
+#include "geometry/ray_packet.hpp"
+
+namespace core {
+
+// Four children per node with bounds stored per axis, so that a single SSE slab test covers them all
+// Empty slots have inverted bounds and can never be hit
+struct alignas(16) bvh4_node {
+	// Minimum x, y, z followed by maximum x, y, z
+	float bounds[6][4];
+
+	uint32_t offsets[4]; // Child node of a branch or first index of a leaf
+	uint16_t counts[4];  // Index count, zero for branches and empty slots
+
+	// Split axes of the collapsed binary nodes: the top one, then the ones under it
+	uint8_t axes[3];
+};
+
+static_assert(sizeof(bvh4_node) == 128);
+
+// BVH4 collapsed from a binary bvh
+class bvh4 {
+public:
+	std::vector<bvh4_node> nodes;
+
+	// Primitive indices in leaf order
+	std::vector<uint32_t> indices;
+
+	void build(const std::vector<geometry::aabb> &bounds,
+			uint32_t bin_count = 16, uint32_t max_leaf_size = 4);
+
+	// Same contract as bvh::intersect
+	template<typename Intersector>
+	void intersect(const geometry::ray &ray, float &max_distance, Intersector &&intersector) const;
+
+	// Traverses the tree with all rays enabled in the mask at once
+	// Calls intersector(index, mask) with the rays that reached the leaf, the intersector may shrink max_distances
+	template<typename Intersector>
+	void intersect_packet(
+			const geometry::ray_packet &rays, int mask,
+			std::array<float, geometry::packet_size> &max_distances,
+			Intersector &&intersector) const;
+
+private:
+	static std::array<uint8_t, 4> get_visit_order(const bvh4_node &node, const bool dir_is_neg[3]);
+};
+
+}
+
+#include "bvh4.inl"
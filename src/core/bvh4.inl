@@ -0,0 +1,205 @@
+namespace core {
+
+template<typename Intersector>
+void bvh4::intersect(const geometry::ray &ray, float &max_distance, Intersector &&intersector) const {
+	if (nodes.empty())
+		return;
+
+	math::fvec3 dir = ray.get_dir();
+	math::fvec3 inv_dir = math::fvec3::one / dir;
+
+	// Signs are read from the bits, so that -0 agrees with its infinite inverse
+	bool dir_is_neg[3] = { std::signbit(dir.x), std::signbit(dir.y), std::signbit(dir.z) };
+
+	// Rows of bvh4_node::bounds facing towards and away from the ray
+	uint8_t near_rows[3], far_rows[3];
+	for (uint8_t axis = 0; axis < 3; axis++) {
+		near_rows[axis] = axis + (dir_is_neg[axis] ? 3 : 0);
+		far_rows[axis]  = axis + (dir_is_neg[axis] ? 0 : 3);
+	}
+
+	__m128 origins[3], inv_dirs[3];
+	for (uint8_t axis = 0; axis < 3; axis++) {
+		origins[axis] = _mm_set1_ps(ray.origin[axis]);
+		inv_dirs[axis] = _mm_set1_ps(inv_dir[axis]);
+	}
+
+	// Leaves are pushed too, so that they get culled once a closer hit is found
+	struct stack_entry {
+		uint32_t offset;
+		uint32_t count;
+		float distance;
+	};
+
+	// Collapsing halves the depth, but every level may push three entries
+	std::array<stack_entry, bvh::max_depth * 2> stack;
+	size_t stack_size = 0;
+
+	stack[stack_size++] = { 0, 0, 0 };
+
+	while (stack_size > 0) {
+		stack_entry entry = stack[--stack_size];
+
+		if (entry.distance > max_distance)
+			continue;
+
+		if (entry.count > 0) {
+			for (uint32_t i = 0; i < entry.count; i++) {
+				if (intersector(indices[entry.offset + i]))
+					return;
+			}
+			continue;
+		}
+
+		const bvh4_node &node = nodes[entry.offset];
+
+		// NaNs from zero direction components are passed over by keeping the accumulator as the second operand
+		__m128 near = _mm_setzero_ps();
+		__m128 far = _mm_set1_ps(max_distance);
+
+		for (uint8_t axis = 0; axis < 3; axis++) {
+			__m128 near_planes = _mm_load_ps(node.bounds[near_rows[axis]]);
+			__m128 far_planes  = _mm_load_ps(node.bounds[far_rows[axis]]);
+
+			near = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(near_planes, origins[axis]), inv_dirs[axis]), near);
+			far  = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(far_planes, origins[axis]), inv_dirs[axis]), far);
+		}
+
+		int hit_mask = _mm_movemask_ps(_mm_cmple_ps(near, far));
+		if (hit_mask == 0)
+			continue;
+
+		alignas(16) float distances[4];
+		_mm_store_ps(distances, near);
+
+		auto order = get_visit_order(node, dir_is_neg);
+
+		// Push back to front, so that the nearest child is popped first
+		for (uint8_t i = 4; i-- > 0;) {
+			uint8_t slot = order[i];
+
+			if (hit_mask & (1 << slot))
+				stack[stack_size++] = { node.offsets[slot], node.counts[slot], distances[slot] };
+		}
+	}
+}
+
+template<typename Intersector>
+void bvh4::intersect_packet(
+		const geometry::ray_packet &rays, int mask,
+		std::array<float, geometry::packet_size> &max_distances,
+		Intersector &&intersector) const {
+	static_assert(geometry::packet_size == 4);
+
+	if (nodes.empty() || mask == 0)
+		return;
+
+	// Rays in SoA form, lane i holds ray i
+	alignas(16) float components[6][4];
+	for (uint8_t i = 0; i < 4; i++) {
+		math::fvec3 inv_dir = math::fvec3::one / rays[i].get_dir();
+
+		for (uint8_t axis = 0; axis < 3; axis++) {
+			components[axis][i]     = rays[i].origin[axis];
+			components[axis + 3][i] = inv_dir[axis];
+		}
+	}
+
+	__m128 origins[3], inv_dirs[3];
+	for (uint8_t axis = 0; axis < 3; axis++) {
+		origins[axis] = _mm_load_ps(components[axis]);
+		inv_dirs[axis] = _mm_load_ps(components[axis + 3]);
+	}
+
+	// Children are ordered by the first enabled ray, the rest are assumed to be coherent with it
+	math::fvec3 dir = rays[std::countr_zero(static_cast<uint32_t>(mask))].get_dir();
+	bool dir_is_neg[3] = { std::signbit(dir.x), std::signbit(dir.y), std::signbit(dir.z) };
+
+	struct stack_entry {
+		__m128 distances;
+		uint32_t offset;
+		uint32_t count;
+		int mask;
+	};
+
+	std::array<stack_entry, bvh::max_depth * 2> stack;
+	size_t stack_size = 0;
+
+	stack[stack_size++] = { _mm_setzero_ps(), 0, 0, mask };
+
+	while (stack_size > 0) {
+		stack_entry entry = stack[--stack_size];
+
+		// Drop the rays that have already found a closer hit
+		__m128 max = _mm_loadu_ps(max_distances.data());
+		entry.mask &= _mm_movemask_ps(_mm_cmple_ps(entry.distances, max));
+
+		if (entry.mask == 0)
+			continue;
+
+		if (entry.count > 0) {
+			for (uint32_t i = 0; i < entry.count; i++)
+				intersector(indices[entry.offset + i], entry.mask);
+			continue;
+		}
+
+		const bvh4_node &node = nodes[entry.offset];
+
+		__m128 slot_distances[4];
+		int slot_masks[4];
+
+		for (uint8_t slot = 0; slot < 4; slot++) {
+			// Without per-ray plane selection the inverted bounds of empty slots would span everything
+			if (node.bounds[0][slot] > node.bounds[3][slot]) {
+				slot_masks[slot] = 0;
+				continue;
+			}
+
+			__m128 near = _mm_setzero_ps();
+			__m128 far = max;
+
+			for (uint8_t axis = 0; axis < 3; axis++) {
+				__m128 min_distances = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.bounds[axis][slot]), origins[axis]), inv_dirs[axis]);
+				__m128 max_distances = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.bounds[axis + 3][slot]), origins[axis]), inv_dirs[axis]);
+
+				near = _mm_max_ps(_mm_min_ps(min_distances, max_distances), near);
+				far  = _mm_min_ps(_mm_max_ps(min_distances, max_distances), far);
+			}
+
+			slot_distances[slot] = near;
+			slot_masks[slot] = _mm_movemask_ps(_mm_cmple_ps(near, far)) & entry.mask;
+		}
+
+		auto order = get_visit_order(node, dir_is_neg);
+
+		for (uint8_t i = 4; i-- > 0;) {
+			uint8_t slot = order[i];
+
+			if (slot_masks[slot] != 0) {
+				stack[stack_size++] = {
+					slot_distances[slot],
+					node.offsets[slot],
+					node.counts[slot],
+					slot_masks[slot]
+				};
+			}
+		}
+	}
+}
+
+// Orders children by direction sign along the split axes, just like a binary traversal would
+inline std::array<uint8_t, 4> bvh4::get_visit_order(const bvh4_node &node, const bool dir_is_neg[3]) {
+	uint8_t first_pair = dir_is_neg[node.axes[0]];
+	uint8_t second_pair = 1 - first_pair;
+	uint8_t first_in_first_pair = dir_is_neg[node.axes[1 + first_pair]];
+	uint8_t first_in_second_pair = dir_is_neg[node.axes[1 + second_pair]];
+
+	return {
+		static_cast<uint8_t>(first_pair * 2 + first_in_first_pair),
+		static_cast<uint8_t>(first_pair * 2 + 1 - first_in_first_pair),
+		static_cast<uint8_t>(second_pair * 2 + first_in_second_pair),
+		static_cast<uint8_t>(second_pair * 2 + 1 - first_in_second_pair)
+	};
+}
+
+}
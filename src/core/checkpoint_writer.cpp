@@ -0,0 +1,39 @@
+#include "core/checkpoint_writer.hpp"
+
+namespace core {
+
+checkpoint_writer::checkpoint_writer(uint32_t thread_count) :
+		pool(thread_count) {}
+
+checkpoint_writer::~checkpoint_writer() {
+	if (pending)
+		pending->wait();
+}
+
+bool checkpoint_writer::try_submit(std::function<void(util::thread_pool &)> save) {
+	if (busy())
+		return false;
+
+	// Errors of a finished checkpoint should not go unnoticed
+	wait();
+
+	pending = pool.submit([this, save = std::move(save)] (uint32_t) {
+		save(pool);
+	});
+
+	return true;
+}
+
+bool checkpoint_writer::busy() const {
+	return pending && !pending->ready();
+}
+
+void checkpoint_writer::wait() {
+	if (!pending)
+		return;
+
+	auto future = std::move(pending);
+	future->rethrow();
+}
+
+}
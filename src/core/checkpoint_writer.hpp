@@ -0,0 +1,34 @@
+#pragma once
+
+#include "pch.hpp"
+
+#include "util/thread_pool.hpp"
+
+namespace core {
+
+// Saves checkpoints on threads of its own, so that rendering goes on in the meantime
+// At most one checkpoint is in flight, newer ones are dropped instead of piling up
+class checkpoint_writer {
+public:
+	// Kept small, because the pool runs alongside the rendering one
+	checkpoint_writer(uint32_t thread_count = 2);
+
+	// Waits for the checkpoint in flight
+	~checkpoint_writer();
+
+	// The save job gets the writer's pool to spread its work over
+	// Returns false if the previous checkpoint is still being saved
+	bool try_submit(std::function<void(util::thread_pool &)> save);
+
+	// Whether a checkpoint is still being saved
+	bool busy() const;
+
+	// Rethrows whatever the checkpoint in flight has thrown
+	void wait();
+
+private:
+	util::thread_pool pool;
+	std::shared_ptr<util::future> pending;
+};
+
+}
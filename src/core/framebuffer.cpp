@@ -0,0 +1,109 @@
+#include "core/framebuffer.hpp"
+
+#include "math/math.hpp"
+#include "util/serialization.hpp"
+
+using namespace math;
+
+namespace core {
+
+framebuffer::framebuffer(const uvec2 &size) :
+		size(size) {
+	size_t pixel_count = static_cast<size_t>(size.x) * size.y;
+
+	red_sums.resize(pixel_count, 0);
+	green_sums.resize(pixel_count, 0);
+	blue_sums.resize(pixel_count, 0);
+	alpha_sums.resize(pixel_count, 0);
+	luminance_sums.resize(pixel_count, 0);
+	luminance_square_sums.resize(pixel_count, 0);
+	sample_counts.resize(pixel_count, 0);
+}
+
+const uvec2 &framebuffer::get_size() const {
+	return size;
+}
+
+size_t framebuffer::get_index(const uvec2 &pixel) const {
+	return static_cast<size_t>(pixel.y) * size.x + pixel.x;
+}
+
+void framebuffer::add_sample(size_t index, const fvec4 &value, float luminance) {
+	red_sums[index] += value.x * value.w;
+	green_sums[index] += value.y * value.w;
+	blue_sums[index] += value.z * value.w;
+	alpha_sums[index] += value.w;
+	luminance_sums[index] += luminance;
+	luminance_square_sums[index] += luminance * luminance;
+	sample_counts[index]++;
+}
+
+uint32_t framebuffer::get_sample_count(size_t index) const {
+	return sample_counts[index];
+}
+
+fvec4 framebuffer::get_average(size_t index) const {
+	// Pixels without any opaque sample stay transparent black
+	if (alpha_sums[index] <= 0)
+		return fvec4::zero;
+
+	fvec3 color = fvec3(red_sums[index], green_sums[index], blue_sums[index]) / alpha_sums[index];
+	return fvec4(color, alpha_sums[index] / sample_counts[index]);
+}
+
+float framebuffer::get_luminance_mean(size_t index) const {
+	if (sample_counts[index] == 0)
+		return 0;
+
+	return luminance_sums[index] / sample_counts[index];
+}
+
+float framebuffer::get_standard_error(size_t index) const {
+	uint32_t count = sample_counts[index];
+
+	if (count < 2)
+		return std::numeric_limits<float>::infinity();
+
+	float mean = luminance_sums[index] / count;
+
+	// Rounding can make the variance of a flat pixel slightly negative
+	float variance = (luminance_square_sums[index] - mean * luminance_sums[index]) / (count - 1);
+	return math::sqrt(math::max(variance, 0.0F) / count);
+}
+
+void framebuffer::save(std::ostream &stream) const {
+	util::write_value(stream, size);
+	util::write_array(stream, red_sums);
+	util::write_array(stream, green_sums);
+	util::write_array(stream, blue_sums);
+	util::write_array(stream, alpha_sums);
+	util::write_array(stream, luminance_sums);
+	util::write_array(stream, luminance_square_sums);
+	util::write_array(stream, sample_counts);
+}
+
+void framebuffer::load(std::span<const std::byte> &data) {
+	uvec2 loaded_size;
+	util::read_value(data, loaded_size);
+
+	if (loaded_size.x != size.x || loaded_size.y != size.y)
+		throw std::runtime_error("Framebuffer size does not match.");
+
+	util::read_array(data, red_sums);
+	util::read_array(data, green_sums);
+	util::read_array(data, blue_sums);
+	util::read_array(data, alpha_sums);
+	util::read_array(data, luminance_sums);
+	util::read_array(data, luminance_square_sums);
+	util::read_array(data, sample_counts);
+
+	size_t pixel_count = static_cast<size_t>(size.x) * size.y;
+
+	for (size_t plane_size : { red_sums.size(), green_sums.size(), blue_sums.size(), alpha_sums.size(),
+			luminance_sums.size(), luminance_square_sums.size(), sample_counts.size() }) {
+		if (plane_size != pixel_count)
+			throw std::runtime_error("Framebuffer size does not match.");
+	}
+}
+
+}
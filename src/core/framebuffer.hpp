@@ -0,0 +1,55 @@
+#pragma once
+
+#include "pch.hpp"
+
+#include "math/vec2.hpp"
+#include "math/vec3.hpp"
+#include "math/vec4.hpp"
+#include "util/aligned_allocator.hpp"
+
+namespace core {
+
+// Accumulates pixel samples as sums, so adding one is just a few additions
+// Every channel is a separate row-major plane, which keeps rows of pixels on consecutive cache lines
+class framebuffer {
+public:
+	static constexpr size_t alignment = 64;
+
+	framebuffer(const math::uvec2 &size);
+
+	const math::uvec2 &get_size() const;
+
+	size_t get_index(const math::uvec2 &pixel) const;
+
+	// The value is expected to be straight, not premultiplied by alpha
+	void add_sample(size_t index, const math::fvec4 &value, float luminance);
+
+	uint32_t get_sample_count(size_t index) const;
+
+	// Returns straight color and the average alpha
+	math::fvec4 get_average(size_t index) const;
+
+	float get_luminance_mean(size_t index) const;
+
+	// Standard error of the mean luminance, infinite with fewer than two samples
+	float get_standard_error(size_t index) const;
+
+	// Writes the raw sums, so that samples can be added to them after load()
+	void save(std::ostream &stream) const;
+
+	// Advances data past what was read, throws if it does not match the size
+	void load(std::span<const std::byte> &data);
+
+private:
+	template<typename T>
+	using plane = std::vector<T, util::aligned_allocator<T, alignment>>;
+
+	math::uvec2 size;
+
+	// Color is premultiplied by alpha, so transparent samples do not tint the pixel
+	plane<float> red_sums, green_sums, blue_sums, alpha_sums;
+	plane<float> luminance_sums, luminance_square_sums;
+	plane<uint32_t> sample_counts;
+};
+
+}
@@ -0,0 +1,774 @@
+#include "core/kd_tree.hpp"
+
+#include "math/math.hpp"
+#include "util/serialization.hpp"
+#include "util/thread_pool.hpp"
+
+using namespace geometry;
+using namespace math;
+
+namespace core {
+
+namespace kd_tree_builder {
+
+// Nodes with this many triangles search for splits in parallel
+static constexpr uint32_t parallel_split_threshold = 16384;
+
+// Events are sorted and swept in chunks of roughly this size
+static constexpr uint32_t parallel_chunk_size = 8192;
+
+// Subtrees smaller than this are not worth a separate job
+static constexpr uint32_t parallel_subtree_threshold = 1024;
+
+// Pool blocks up to this size, so that event lists of all but the largest nodes get recycled
+static constexpr size_t largest_pooled_block = 1 << 20;
+
+static constexpr uint8_t left_side  = 1;
+static constexpr uint8_t right_side = 2;
+static constexpr uint8_t both_sides = left_side | right_side;
+
+// Start or end of a triangle's bounds along one axis
+struct event {
+	float position;
+	uint32_t triangle; // Index into the node's triangle list
+	bool start;
+};
+
+// Triangles of a node together with their events sorted along every axis
+// Events are sorted just once for the root,
+// child lists are filtered out of their parent's ones in order
+struct node_data {
+	std::pmr::vector<uint32_t> triangles;
+	std::array<std::pmr::vector<event>, 3> events;
+
+	node_data(std::pmr::memory_resource *resource) :
+			triangles(resource), events{
+				std::pmr::vector<event>(resource),
+				std::pmr::vector<event>(resource),
+				std::pmr::vector<event>(resource) } {}
+};
+
+struct split_candidate {
+	float cost = std::numeric_limits<float>::max();
+	uint8_t axis;
+	float split;
+};
+
+static std::unique_ptr<std::pmr::memory_resource> make_arena() {
+	return std::make_unique<std::pmr::unsynchronized_pool_resource>(
+			std::pmr::pool_options{ 0, largest_pooled_block });
+}
+
+static void init_leaf(
+		kd_tree &tree, uint32_t node,
+		std::span<const uint32_t> indices) {
+	tree.nodes[node] = kd_tree_node::make_leaf(
+			tree.indices.size(), indices.size());
+
+	tree.indices.insert(tree.indices.end(),
+			indices.begin(), indices.end());
+}
+
+// Children are allocated next to each other
+static uint32_t init_branch(
+		kd_tree &tree, uint32_t node,
+		uint8_t axis, float split) {
+	uint32_t children = tree.nodes.size();
+	tree.nodes.resize(children + 2);
+
+	// Empty children will remain empty leaves
+	tree.nodes[children] = tree.nodes[children + 1] =
+			kd_tree_node::make_leaf(0, 0);
+
+	tree.nodes[node] = kd_tree_node::make_branch(
+			axis, split, children);
+
+	return children;
+}
+
+static std::tuple<aabb, aabb> split_aabb(
+		const aabb &aabb,
+		uint8_t axis, float split) {
+	geometry::aabb laabb, raabb;
+	laabb = raabb = aabb;
+
+	// Left node contains objects
+	// with smaller position
+	laabb.max[axis] = split;
+	raabb.min[axis] = split;
+
+	return { laabb, raabb };
+}
+
+// Triangles starting at or after the split go right, the ones ending before it go left
+static uint8_t get_side(
+		const aabb &bounds,
+		uint8_t axis, float split) {
+	if (bounds.min[axis] >= split)
+		return right_side;
+	if (bounds.max[axis] < split)
+		return left_side;
+	return both_sides;
+}
+
+// Moves a separately built subtree into the tree, placing its root at the given node
+static void splice_subtree(kd_tree &tree, uint32_t node, const kd_tree &subtree) {
+	// Subtree node i > 0 is going to be appended at node_offset + i
+	uint32_t node_offset = tree.nodes.size() - 1;
+	uint32_t index_offset = tree.indices.size();
+
+	auto relocate = [&] (kd_tree_node node) {
+		if (node.is_leaf())
+			node.first_index += index_offset;
+		else
+			node.flags += node_offset << 2;
+
+		return node;
+	};
+
+	tree.nodes[node] = relocate(subtree.nodes.front());
+
+	for (size_t i = 1; i < subtree.nodes.size(); i++)
+		tree.nodes.push_back(relocate(subtree.nodes[i]));
+
+	tree.indices.insert(tree.indices.end(),
+			subtree.indices.begin(), subtree.indices.end());
+}
+
+static void init_node_median(
+		kd_tree &tree, uint32_t node,
+		const aabb &aabb,
+		const std::vector<geometry::aabb> &bounds,
+		std::vector<uint32_t> &&indices,
+		uint8_t depth) {
+	// Create leaf node once
+	// we've reached maximum depth
+	if (depth == 0) {
+		init_leaf(tree, node, indices);
+		return;
+	}
+
+	// We split in the middle
+	fvec3 widths = aabb.max - aabb.min;
+	uint8_t axis = std::max_element(&widths.x,
+			&widths.x + 3) - &widths.x;
+	float split = aabb.min[axis] +
+			widths[axis] * 0.5F;
+
+	uint32_t children = init_branch(tree, node, axis, split);
+
+	auto [laabb, raabb] = split_aabb(aabb,
+			axis, split);
+
+	std::vector<uint32_t> lindices, rindices;
+
+	for (uint32_t index : indices) {
+		uint8_t side = get_side(bounds[index], axis, split);
+
+		if (side & left_side)
+			lindices.push_back(index);
+
+		if (side & right_side)
+			rindices.push_back(index);
+	}
+
+	indices = {};
+
+	if (lindices.size() > 0) {
+		init_node_median(tree, children,
+				laabb, bounds,
+				std::move(lindices),
+				depth - 1);
+	}
+
+	if (rindices.size() > 0) {
+		init_node_median(tree, children + 1,
+				raabb, bounds,
+				std::move(rindices),
+				depth - 1);
+	}
+}
+
+static void sort_events(std::pmr::vector<event> &events, bool parallel) {
+	auto less = [] (const event &x, const event &y) { return x.position < y.position; };
+
+	uint32_t chunk_count = parallel ? (events.size() + parallel_chunk_size - 1) / parallel_chunk_size : 1;
+	chunk_count = math::min(chunk_count, util::thread_pool::common_pool.thread_count() * 4);
+
+	if (chunk_count <= 1) {
+		std::sort(events.begin(), events.end(), less);
+		return;
+	}
+
+	auto chunk_begin = [&] (uint32_t chunk) {
+		return events.begin() + (events.size() * math::min(chunk, chunk_count)) / chunk_count;
+	};
+
+	// Sort chunks independently and then merge them pairwise
+	util::thread_pool::common_pool.parallel_for(chunk_count, [&] (uint32_t chunk) {
+		std::sort(chunk_begin(chunk), chunk_begin(chunk + 1), less);
+	});
+
+	for (uint32_t width = 1; width < chunk_count; width *= 2) {
+		uint32_t merge_count = (chunk_count + width * 2 - 1) / (width * 2);
+
+		util::thread_pool::common_pool.parallel_for(merge_count, [&] (uint32_t merge) {
+			uint32_t chunk = merge * width * 2;
+			std::inplace_merge(chunk_begin(chunk), chunk_begin(chunk + width),
+					chunk_begin(chunk + width * 2), less);
+		});
+	}
+}
+
+// Evaluates candidate splits in [begin, end), lcount and rcount must account for events [0, begin)
+// Candidate i splits the volume between events i - 1 and i
+static split_candidate sweep_events(
+		const std::pmr::vector<event> &events,
+		const aabb &aabb, uint8_t axis,
+		size_t begin, size_t end,
+		uint32_t lcount, uint32_t rcount) {
+	split_candidate best;
+
+	for (size_t i = begin; i < end; i++) {
+		if (i > begin) {
+			if (events[i - 1].start)
+				lcount++;
+			else
+				rcount--;
+		}
+
+		float split;
+
+		if (i == 0)
+			split = events.front().position - math::epsilon;
+		else if (i == events.size())
+			split = events.back().position + math::epsilon;
+		else {
+			float prev_position = events[i - 1].position;
+			float next_position = events[i].position;
+
+			if (prev_position == next_position)
+				continue;
+
+			split = (prev_position + next_position) * 0.5F;
+		}
+
+		// Accumulate events until we enter the AABB
+		if (split <= aabb.min[axis])
+			continue;
+
+		if (split >= aabb.max[axis])
+			break;
+
+		auto [laabb, raabb] = split_aabb(
+				aabb, axis, split);
+
+		float cost = lcount * laabb.get_surface_area()
+				   + rcount * raabb.get_surface_area();
+
+		if (cost < best.cost)
+			best = { cost, axis, split };
+	}
+
+	return best;
+}
+
+static split_candidate find_split(
+		const aabb &aabb,
+		const std::pmr::vector<event> &events,
+		uint32_t triangle_count,
+		uint8_t axis, bool parallel) {
+	// There is one more candidate than there are events
+	size_t candidate_count = events.size() + 1;
+
+	uint32_t chunk_count = parallel ? (candidate_count + parallel_chunk_size - 1) / parallel_chunk_size : 1;
+	chunk_count = math::min(chunk_count, util::thread_pool::common_pool.thread_count() * 4);
+
+	if (chunk_count <= 1)
+		return sweep_events(events, aabb, axis, 0, candidate_count, 0, triangle_count);
+
+	auto chunk_begin = [&] (uint32_t chunk) -> size_t {
+		return (candidate_count * chunk) / chunk_count;
+	};
+
+	// First count the starts within each chunk, so that every chunk knows its initial counts
+	std::vector<uint32_t> start_counts(chunk_count + 1, 0);
+
+	util::thread_pool::common_pool.parallel_for(chunk_count, [&] (uint32_t chunk) {
+		size_t end = math::min(chunk_begin(chunk + 1), events.size());
+		for (size_t i = chunk_begin(chunk); i < end; i++)
+			start_counts[chunk + 1] += events[i].start;
+	});
+
+	std::partial_sum(start_counts.begin(), start_counts.end(), start_counts.begin());
+
+	std::vector<split_candidate> candidates(chunk_count);
+
+	util::thread_pool::common_pool.parallel_for(chunk_count, [&] (uint32_t chunk) {
+		size_t begin = chunk_begin(chunk);
+		uint32_t lcount = start_counts[chunk];
+		uint32_t rcount = triangle_count - (begin - lcount);
+
+		candidates[chunk] = sweep_events(events, aabb, axis,
+				begin, chunk_begin(chunk + 1), lcount, rcount);
+	});
+
+	// Earlier chunks win ties just like in a serial sweep
+	split_candidate best;
+	for (const split_candidate &candidate : candidates) {
+		if (candidate.cost < best.cost)
+			best = candidate;
+	}
+
+	return best;
+}
+
+// Distributes the node's triangles and events among its children without sorting anything
+static void split_node(
+		const node_data &data,
+		uint8_t axis, float split,
+		node_data &ldata, node_data &rdata,
+		bool parallel) {
+	uint32_t triangle_count = data.triangles.size();
+	std::pmr::memory_resource *resource = data.triangles.get_allocator().resource();
+
+	// Classify triangles by their events along the split axis
+	std::pmr::vector<uint8_t> sides(triangle_count, both_sides, resource);
+
+	for (const event &event : data.events[axis]) {
+		if (event.start && event.position >= split)
+			sides[event.triangle] = right_side;
+		else if (!event.start && event.position < split)
+			sides[event.triangle] = left_side;
+	}
+
+	// Number the triangles within each child
+	std::pmr::vector<uint32_t> lmap(triangle_count, resource);
+	std::pmr::vector<uint32_t> rmap(triangle_count, resource);
+
+	for (uint32_t i = 0; i < triangle_count; i++) {
+		if (sides[i] & left_side) {
+			lmap[i] = ldata.triangles.size();
+			ldata.triangles.push_back(data.triangles[i]);
+		}
+
+		if (sides[i] & right_side) {
+			rmap[i] = rdata.triangles.size();
+			rdata.triangles.push_back(data.triangles[i]);
+		}
+	}
+
+	// Every triangle has exactly two events per axis
+	// Lists are allocated up front, so that axes can be filled in parallel
+	for (uint8_t axis = 0; axis < 3; axis++) {
+		ldata.events[axis].resize(ldata.triangles.size() * 2);
+		rdata.events[axis].resize(rdata.triangles.size() * 2);
+	}
+
+	auto split_events = [&] (uint32_t axis) {
+		event *levent = ldata.events[axis].data();
+		event *revent = rdata.events[axis].data();
+
+		for (const event &event : data.events[axis]) {
+			uint8_t side = sides[event.triangle];
+
+			if (side & left_side)
+				*levent++ = { event.position, lmap[event.triangle], event.start };
+
+			if (side & right_side)
+				*revent++ = { event.position, rmap[event.triangle], event.start };
+		}
+	};
+
+	if (parallel)
+		util::thread_pool::common_pool.parallel_for(3, split_events);
+	else {
+		for (uint8_t axis = 0; axis < 3; axis++)
+			split_events(axis);
+	}
+}
+
+// Alternative to init_node_median
+// Nodes at the top parallel_depth levels build their subtrees as separate jobs
+static void init_node_sah(
+		kd_tree &tree, uint32_t node,
+		const aabb &aabb,
+		node_data &&data,
+		uint8_t depth, uint8_t parallel_depth) {
+	uint32_t triangle_count = data.triangles.size();
+
+	// Create leaf node once
+	// we've reached maximum depth
+	if (depth == 0 || triangle_count == 0) {
+		init_leaf(tree, node, data.triangles);
+		return;
+	}
+
+	float base_cost = triangle_count * aabb.get_surface_area();
+
+	std::array<split_candidate, 3> candidates;
+	bool parallel = triangle_count >= parallel_split_threshold;
+
+	if (parallel) {
+		util::thread_pool::common_pool.parallel_for(3, [&] (uint32_t axis) {
+			candidates[axis] = find_split(aabb, data.events[axis], triangle_count, axis, true);
+		});
+	} else {
+		for (uint8_t axis = 0; axis < 3; axis++)
+			candidates[axis] = find_split(aabb, data.events[axis], triangle_count, axis, false);
+	}
+
+	split_candidate best;
+	for (const split_candidate &candidate : candidates) {
+		if (candidate.cost < best.cost)
+			best = candidate;
+	}
+
+	if (best.cost >= base_cost) {
+		init_leaf(tree, node, data.triangles);
+		return;
+	}
+
+	uint32_t children = init_branch(tree, node,
+			best.axis, best.split);
+
+	auto [laabb, raabb] = split_aabb(aabb,
+			best.axis, best.split);
+
+	// Large children are built as separate jobs, each one with its own arena
+	bool spawn = false;
+	if (parallel_depth > 0) {
+		uint32_t lcount = 0, rcount = 0;
+		for (const event &event : data.events[best.axis]) {
+			lcount += !event.start && event.position < best.split;
+			rcount += event.start && event.position >= best.split;
+		}
+
+		// Triangles on both sides are counted in neither
+		uint32_t shared = triangle_count - lcount - rcount;
+		spawn = lcount + shared >= parallel_subtree_threshold &&
+				rcount + shared >= parallel_subtree_threshold;
+	}
+
+	std::unique_ptr<std::pmr::memory_resource> larena, rarena;
+	std::pmr::memory_resource *resource = data.triangles.get_allocator().resource();
+
+	if (spawn) {
+		larena = make_arena();
+		rarena = make_arena();
+	}
+
+	node_data ldata(spawn ? larena.get() : resource);
+	node_data rdata(spawn ? rarena.get() : resource);
+
+	split_node(data, best.axis, best.split,
+			ldata, rdata, parallel);
+
+	// Release memory before descending
+	{ node_data released = std::move(data); }
+
+	if (spawn) {
+		kd_tree lsubtree, rsubtree;
+		lsubtree.nodes.resize(1);
+		rsubtree.nodes.resize(1);
+
+		util::thread_pool::common_pool.parallel_for(2, [&] (uint32_t i) {
+			if (i == 0) {
+				init_node_sah(lsubtree, 0, laabb,
+						std::move(ldata),
+						depth - 1, parallel_depth - 1);
+			} else {
+				init_node_sah(rsubtree, 0, raabb,
+						std::move(rdata),
+						depth - 1, parallel_depth - 1);
+			}
+		});
+
+		splice_subtree(tree, children, lsubtree);
+		splice_subtree(tree, children + 1, rsubtree);
+		return;
+	}
+
+	if (ldata.triangles.size() > 0) {
+		init_node_sah(tree, children, laabb,
+				std::move(ldata),
+				depth - 1, parallel_depth);
+	}
+
+	if (rdata.triangles.size() > 0) {
+		init_node_sah(tree, children + 1, raabb,
+				std::move(rdata),
+				depth - 1, parallel_depth);
+	}
+}
+
+}
+
+void kd_tree::build(
+		const std::vector<triangle> &triangles,
+		const geometry::aabb &aabb,
+		bool use_sah, uint8_t max_depth) {
+	max_depth = math::min(max_depth, kd_tree::max_depth - 1);
+
+	this->aabb = aabb;
+	this->triangles = triangles;
+	nodes.clear();
+	indices.clear();
+
+	std::vector<geometry::aabb> bounds;
+	bounds.reserve(triangles.size());
+
+	for (const triangle &triangle : triangles) {
+		geometry::aabb &aabb = bounds.emplace_back();
+		aabb.clear();
+		aabb.add(triangle.a);
+		aabb.add(triangle.b);
+		aabb.add(triangle.c);
+	}
+
+	std::cout << "Building kD tree..." << std::endl;
+
+	// Allocate the root
+	nodes.resize(1);
+
+	// Enough subtree jobs to keep every thread busy
+	uint32_t thread_count = util::thread_pool::common_pool.thread_count();
+	uint8_t parallel_depth = std::bit_width(thread_count) + 2;
+	
+	// Start executing initial job
+	if (use_sah) {
+		auto arena = kd_tree_builder::make_arena();
+		kd_tree_builder::node_data data(arena.get());
+
+		data.triangles.resize(triangles.size());
+		std::iota(data.triangles.begin(), data.triangles.end(), 0);
+
+		// The arena is not thread-safe, so allocate before going parallel
+		for (auto &events : data.events)
+			events.resize(bounds.size() * 2);
+
+		// This is the only time events get sorted
+		util::thread_pool::common_pool.parallel_for(3, [&] (uint32_t axis) {
+			auto &events = data.events[axis];
+
+			for (uint32_t i = 0; i < bounds.size(); i++) {
+				events[i * 2]     = { bounds[i].min[axis], i, true };
+				events[i * 2 + 1] = { bounds[i].max[axis], i, false };
+			}
+
+			kd_tree_builder::sort_events(events, true);
+		});
+
+		bounds = {};
+
+		kd_tree_builder::init_node_sah(
+				*this, 0, aabb,
+				std::move(data),
+				max_depth, parallel_depth);
+	} else {
+		std::vector<uint32_t> root_indices(triangles.size());
+		std::iota(root_indices.begin(), root_indices.end(), 0);
+
+		kd_tree_builder::init_node_median(
+				*this, 0, aabb, bounds,
+				std::move(root_indices),
+				max_depth);
+	}
+
+	nodes.shrink_to_fit();
+	indices.shrink_to_fit();
+}
+
+kd_tree::intersection kd_tree::intersect(const ray &ray, uint8_t visualize_depth) const {
+	auto result = aabb.intersect(ray);
+	if (!result.has_hit() || nodes.empty())
+		return {};
+
+	// Avoid divisions when computing distances to split planes
+	fvec3 inv_dir = fvec3::one / ray.get_dir();
+
+	// uint8_t depth is only used for tree visualization 
+	struct stack_entry {
+		uint32_t node;
+		float min_dist, max_dist;
+		uint8_t depth;
+	};
+
+	std::array<stack_entry, kd_tree::max_depth> stack;
+	size_t stack_size = 0;
+
+	stack[stack_size++] = { 0, result.near, result.far, 1 };
+
+	while (stack_size > 0) {
+		auto [node_index, min_dist, max_dist, depth] = stack[--stack_size];
+		const kd_tree_node *node = &nodes[node_index];
+
+		// Explore down the tree until we reach a leaf
+		while (!node->is_leaf()) {
+			if (depth++ == visualize_depth) {
+				std::mt19937 rng{node_index};
+				float hue = std::uniform_real_distribution<float>{0, 1}(rng);
+
+				fvec3 color = math::saturate(fvec3(
+					math::abs(hue * 6 - 3 ) - 1,
+					2 - math::abs(hue * 6 - 2),
+					2 - math::abs(hue * 6 - 4)
+				));
+
+				return {
+					min_dist,
+					color, // Random color instead of barycentric coordinates
+					static_cast<uint32_t>(-1) // No index
+				};
+			}
+
+			uint8_t axis = node->get_axis();
+
+			// Distance to the split plane
+			float split_dist = (node->split - ray.origin[axis]) * inv_dir[axis];
+			
+			uint32_t first, second;
+
+			if (ray.origin[axis] < node->split) {
+				first = node->get_children();
+				second = first + 1;
+			} else {
+				second = node->get_children();
+				first = second + 1;
+			}
+			
+			// If ray points away from the split plane
+			// or if the back of the AABB is closer
+			// than distance to the split plane,
+			// we've hit just the first node
+			if (split_dist < 0 || split_dist > max_dist)
+				node_index = first;
+
+			// When node's AABB is further away than the split plane
+			// then we've hit second node only
+			else if (split_dist < min_dist)
+				node_index = second;
+
+			// Otherwise we've hit them both
+			else {
+				stack[stack_size++] = { second, split_dist, max_dist, depth };
+
+				node_index = first;
+				max_dist = split_dist;
+			}
+
+			node = &nodes[node_index];
+		}
+
+		// It's a leaf node
+		const uint32_t *leaf_indices = indices.data() + node->first_index;
+		uint32_t index_count = node->get_index_count();
+
+		triangle::intersection nearest_hit;
+		uint32_t index = 0;
+
+		for (uint32_t i = 0; i < index_count; i++) {
+			auto hit = triangles[leaf_indices[i]].intersect(ray);
+			if (hit.has_hit() && hit.distance <= max_dist &&
+					(hit.distance < nearest_hit.distance ||
+					!nearest_hit.has_hit())) {
+				nearest_hit = hit;
+				index = leaf_indices[i];
+			}
+		}
+
+		if (!nearest_hit.has_hit())
+			continue;
+
+		if (visualize_depth != 0)
+			return {};
+
+		return {
+			nearest_hit.distance,
+			nearest_hit.barycentric,
+			index
+		};
+	}
+
+	return {};
+}
+
+bool kd_tree::occluded(const ray &ray, float max_distance) const {
+	auto result = aabb.intersect(ray);
+	if (!result.has_hit() || result.near > max_distance || nodes.empty())
+		return false;
+
+	fvec3 inv_dir = fvec3::one / ray.get_dir();
+
+	struct stack_entry {
+		uint32_t node;
+		float min_dist, max_dist;
+	};
+
+	std::array<stack_entry, kd_tree::max_depth> stack;
+	size_t stack_size = 0;
+
+	stack[stack_size++] = { 0, result.near, math::min(result.far, max_distance) };
+
+	while (stack_size > 0) {
+		auto [node_index, min_dist, max_dist] = stack[--stack_size];
+		const kd_tree_node *node = &nodes[node_index];
+
+		// Same descent as in intersect
+		while (!node->is_leaf()) {
+			uint8_t axis = node->get_axis();
+			float split_dist = (node->split - ray.origin[axis]) * inv_dir[axis];
+
+			uint32_t first, second;
+
+			if (ray.origin[axis] < node->split) {
+				first = node->get_children();
+				second = first + 1;
+			} else {
+				second = node->get_children();
+				first = second + 1;
+			}
+
+			if (split_dist < 0 || split_dist > max_dist)
+				node_index = first;
+			else if (split_dist < min_dist)
+				node_index = second;
+			else {
+				stack[stack_size++] = { second, split_dist, max_dist };
+
+				node_index = first;
+				max_dist = split_dist;
+			}
+
+			node = &nodes[node_index];
+		}
+
+		// Any hit will do, even one that lies outside of this leaf
+		const uint32_t *leaf_indices = indices.data() + node->first_index;
+		uint32_t index_count = node->get_index_count();
+
+		for (uint32_t i = 0; i < index_count; i++) {
+			auto hit = triangles[leaf_indices[i]].intersect(ray);
+			if (hit.has_hit() && hit.distance <= max_distance)
+				return true;
+		}
+	}
+
+	return false;
+}
+
+void kd_tree::save(std::ostream &stream) const {
+	util::write_value(stream, aabb);
+	util::write_array(stream, nodes);
+	util::write_array(stream, indices);
+	util::write_array(stream, triangles);
+}
+
+void kd_tree::load(std::span<const std::byte> data) {
+	util::read_value(data, aabb);
+	util::read_array(data, nodes);
+	util::read_array(data, indices);
+	util::read_array(data, triangles);
+}
+
+}
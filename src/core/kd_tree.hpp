@@ -2,31 +2,89 @@
 
 #include "pch.hpp"
 
+#include "core/accelerator.hpp"
 #include "geometry/aabb.hpp"
 #include "geometry/ray.hpp"
 #include "geometry/triangle.hpp"
 
 namespace core {
 
-class kd_tree_node {
-public:
-	virtual ~kd_tree_node() {}
-	
-protected:
-	kd_tree_node() {}
-};
+// Nodes are 8 bytes each and are stored in a single array
+// Children of a branch are adjacent, so only the left one is referenced
+struct kd_tree_node {
+	static constexpr uint32_t leaf_flag = 3;
 
-class kd_tree_branch : public kd_tree_node {
-public:
-	uint8_t axis;
-	float split;
-	std::shared_ptr<kd_tree_node> left, right;
+	union {
+		float split;          // Branch
+		uint32_t first_index; // Leaf
+	};
+
+	// Lowest two bits store the axis or the leaf flag
+	// The rest is either the child offset or the triangle count
+	uint32_t flags;
+
+	static kd_tree_node make_branch(uint8_t axis, float split, uint32_t children) {
+		kd_tree_node node;
+		node.split = split;
+		node.flags = (children << 2) | axis;
+		return node;
+	}
+
+	static kd_tree_node make_leaf(uint32_t first_index, uint32_t index_count) {
+		kd_tree_node node;
+		node.first_index = first_index;
+		node.flags = (index_count << 2) | leaf_flag;
+		return node;
+	}
+
+	bool is_leaf() const {
+		return (flags & 3) == leaf_flag;
+	}
+
+	uint8_t get_axis() const {
+		return flags & 3;
+	}
+
+	// Index of the left child, the right one comes right after it
+	uint32_t get_children() const {
+		return flags >> 2;
+	}
+
+	uint32_t get_index_count() const {
+		return flags >> 2;
+	}
 };
 
-class kd_tree_leaf : public kd_tree_node {
+static_assert(sizeof(kd_tree_node) == 8);
+
+class kd_tree : public accelerator {
 public:
-	std::vector<geometry::triangle> triangles;
+	// Traversal uses a fixed-size stack
+	static constexpr uint8_t max_depth = 64;
+
+	// Bounds of the root node
+	geometry::aabb aabb;
+
+	// The root is always the first node
+	std::vector<kd_tree_node> nodes;
+
+	// Leaves point into this shared array of triangle indices
 	std::vector<uint32_t> indices;
+
+	// Triangle positions in mesh order, each stored just once
+	std::vector<geometry::triangle> triangles;
+
+	void build(const std::vector<geometry::triangle> &triangles,
+			const geometry::aabb &aabb,
+			bool use_sah = true, uint8_t max_depth = 25);
+
+	intersection intersect(const geometry::ray &ray, uint8_t visualize_depth = 0) const override;
+
+	bool occluded(const geometry::ray &ray, float max_distance) const override;
+
+	void save(std::ostream &stream) const override;
+
+	void load(std::span<const std::byte> data) override;
 };
 
 }
@@ -0,0 +1,38 @@
+#include "core/light_bvh.hpp"
+
+#include "geometry/aabb.hpp"
+
+using namespace geometry;
+using namespace math;
+
+namespace core {
+
+void light_bvh::build(const std::vector<fvec3> &positions, const std::vector<float> &powers) {
+	std::vector<aabb> bounds;
+	bounds.reserve(positions.size());
+	for (const fvec3 &position : positions)
+		bounds.emplace_back(position, position);
+
+	// Single-light leaves, so that every light gets its own importance
+	bvh.build(bounds, 16, 1);
+
+	// Children come after their parent, so the powers are summed up in reverse
+	node_powers.resize(bvh.nodes.size());
+	for (size_t i = bvh.nodes.size(); i-- > 0;) {
+		const bvh_node &node = bvh.nodes[i];
+
+		if (node.count > 0) {
+			node_powers[i] = 0;
+			for (uint32_t j = 0; j < node.count; j++)
+				node_powers[i] += powers[bvh.indices[node.offset + j]];
+		} else {
+			node_powers[i] = node_powers[i + 1] + node_powers[node.offset];
+		}
+	}
+}
+
+bool light_bvh::empty() const {
+	return bvh.nodes.empty();
+}
+
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "pch.hpp"
+
+#include "core/bvh.hpp"
+#include "math/vec3.hpp"
+
+namespace core {
+
+// Picks one of many point-like lights as seen from a shading point, walking down a single path of a BVH over them
+// Every branch is chosen in proportion to an estimate of the light its children send there, so the cost grows with the depth of the tree
+class light_bvh {
+public:
+	// Powers are the weights lights get from far away, in the units that the importance in sample() uses
+	void build(const std::vector<math::fvec3> &positions, const std::vector<float> &powers);
+
+	bool empty() const;
+
+	// Calls importance(index) for the lights in the leaves next to the path, which can account for what the tree does not know, like their orientation
+	// Expects rand in [0, 1) and returns false if no light sends anything to the position
+	template<typename Importance>
+	bool sample(const math::fvec3 &position, float rand, Importance &&importance,
+			uint32_t &index, float &probability) const;
+
+private:
+	core::bvh bvh;
+
+	// Summed power of the lights under every node
+	std::vector<float> node_powers;
+};
+
+}
+
+#include "light_bvh.inl"
@@ -0,0 +1,83 @@
+namespace core {
+
+template<typename Importance>
+bool light_bvh::sample(const math::fvec3 &position, float rand, Importance &&importance,
+		uint32_t &index, float &probability) const {
+	if (bvh.nodes.empty())
+		return false;
+
+	// Leaves are weighted exactly, branches by their power spread over their bounds
+	auto get_node_importance = [&] (uint32_t node_index) {
+		const bvh_node &node = bvh.nodes[node_index];
+
+		if (node.count > 0) {
+			float sum = 0;
+			for (uint32_t i = 0; i < node.count; i++)
+				sum += importance(bvh.indices[node.offset + i]);
+			return sum;
+		}
+
+		// Points inside the bounds could be right next to any of the lights
+		math::fvec3 to_center = (node.aabb.min + node.aabb.max) * 0.5F - position;
+		math::fvec3 half_size = (node.aabb.max - node.aabb.min) * 0.5F;
+		float distance_squared = math::max(math::dot(to_center, to_center), math::dot(half_size, half_size), math::epsilon);
+
+		return node_powers[node_index] / distance_squared;
+	};
+
+	// The random number is rescaled after every choice, so that one is enough for the whole path
+	auto choose = [&rand] (float chance) {
+		bool chosen = rand < chance;
+		rand = chosen ? rand / chance : (rand - chance) / (1 - chance);
+		rand = math::min(rand, 0.99999994F);
+		return chosen;
+	};
+
+	probability = 1;
+	uint32_t node_index = 0;
+
+	while (bvh.nodes[node_index].count == 0) {
+		const bvh_node &node = bvh.nodes[node_index];
+
+		float left = get_node_importance(node_index + 1);
+		float right = get_node_importance(node.offset);
+
+		if (left + right <= 0)
+			return false;
+
+		float left_probability = left / (left + right);
+
+		if (choose(left_probability)) {
+			node_index = node_index + 1;
+			probability *= left_probability;
+		} else {
+			node_index = node.offset;
+			probability *= 1 - left_probability;
+		}
+	}
+
+	const bvh_node &leaf = bvh.nodes[node_index];
+	float total = get_node_importance(node_index);
+
+	if (total <= 0)
+		return false;
+
+	// Lights are passed over one by one, each with the chance it has among the ones left
+	float remaining = total;
+
+	for (uint32_t i = 0; i < leaf.count; i++) {
+		index = bvh.indices[leaf.offset + i];
+		float light_importance = importance(index);
+
+		if (i + 1 == leaf.count || choose(light_importance / remaining)) {
+			probability *= light_importance / total;
+			return light_importance > 0;
+		}
+
+		remaining -= light_importance;
+	}
+
+	return false;
+}
+
+}
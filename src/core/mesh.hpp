@@ -2,28 +2,25 @@
 
 #include "pch.hpp"
 
-#include "core/kd_tree.hpp"
+#include "core/accelerator.hpp"
 #include "core/material.hpp"
 #include "core/vertex.hpp"
+#include "geometry/aabb.hpp"
 #include "geometry/ray.hpp"
+#include "geometry/ray_packet.hpp"
+#include "geometry/triangle.hpp"
 #include "math/vec2.hpp"
 #include "math/vec3.hpp"
 
 namespace core {
 
 struct mesh {
-	struct intersection {
-		float distance = -1;
-		math::fvec3 barycentric;
-		uint32_t index;
-
-		bool has_hit() const;
-	};
+	using intersection = core::accelerator::intersection;
 
 	std::vector<vertex> vertices;
 	std::vector<math::uvec3> triangles;
 	geometry::aabb aabb;
-	std::shared_ptr<kd_tree_node> kd_tree = nullptr;
+	std::unique_ptr<core::accelerator> accelerator;
 	std::shared_ptr<core::material> material = nullptr;
 
 	// void recalculate_normals(bool shade_smooth = false);
@@ -32,9 +29,32 @@ struct mesh {
 
 	void recalculate_aabb();
 
+	std::vector<geometry::triangle> get_triangle_positions() const;
+
+	// Covers all vertex attributes and indices, identical geometry always hashes the same
+	uint64_t get_hash() const;
+
+	// The kD tree is built within the AABB, so it must be up to date
 	void build_kd_tree(bool use_sah = true, uint8_t max_depth = 25);
 
+	void build_bvh(uint32_t bin_count = 16, uint32_t max_leaf_size = 4);
+
+	// Built structures are reused from the cache directory if it is set and holds one for identical geometry
+	void build_accelerator(accelerator_type type,
+			const std::filesystem::path &cache_directory = {});
+
 	intersection intersect(const geometry::ray &ray, uint8_t visualize_kd_tree_depth = 0) const;
+
+	bool occluded(const geometry::ray &ray, float max_distance) const;
+
+	std::array<intersection, geometry::packet_size> intersect_packet(
+			const geometry::ray_packet &rays, int mask) const;
+
+private:
+	struct cache_header;
+
+	// Returns false if there is no matching file
+	bool load_cached_accelerator(const std::filesystem::path &path, const cache_header &expected);
 };
 
 }
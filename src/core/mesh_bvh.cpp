@@ -0,0 +1,98 @@
+#include "core/mesh_bvh.hpp"
+
+#include "util/serialization.hpp"
+
+using namespace geometry;
+using namespace math;
+
+namespace core {
+
+void mesh_bvh::build(
+		const std::vector<triangle> &triangles,
+		uint32_t bin_count, uint32_t max_leaf_size) {
+	this->triangles = triangles;
+
+	std::vector<geometry::aabb> bounds;
+	bounds.reserve(triangles.size());
+
+	for (const triangle &triangle : triangles) {
+		geometry::aabb &aabb = bounds.emplace_back();
+		aabb.clear();
+		aabb.add(triangle.a);
+		aabb.add(triangle.b);
+		aabb.add(triangle.c);
+	}
+
+	std::cout << "Building BVH..." << std::endl;
+
+	bvh.build(bounds, bin_count, max_leaf_size);
+}
+
+// Tree visualization is not supported, so visualize_depth is ignored
+mesh_bvh::intersection mesh_bvh::intersect(const ray &ray, uint8_t) const {
+	intersection nearest_hit;
+	float max_distance = std::numeric_limits<float>::max();
+
+	bvh.intersect(ray, max_distance, [&] (uint32_t index) {
+		auto hit = triangles[index].intersect(ray);
+
+		if (hit.has_hit() && hit.distance < max_distance) {
+			nearest_hit = { hit.distance, hit.barycentric, index };
+			max_distance = hit.distance;
+		}
+
+		return false;
+	});
+
+	return nearest_hit;
+}
+
+bool mesh_bvh::occluded(const ray &ray, float max_distance) const {
+	bool occluded = false;
+
+	bvh.intersect(ray, max_distance, [&] (uint32_t index) {
+		auto hit = triangles[index].intersect(ray);
+
+		occluded = hit.has_hit() && hit.distance <= max_distance;
+		return occluded;
+	});
+
+	return occluded;
+}
+
+std::array<mesh_bvh::intersection, packet_size> mesh_bvh::intersect_packet(
+		const ray_packet &rays, int mask) const {
+	std::array<intersection, packet_size> nearest_hits;
+	std::array<float, packet_size> max_distances;
+	max_distances.fill(std::numeric_limits<float>::max());
+
+	bvh.intersect_packet(rays, mask, max_distances, [&] (uint32_t index, int leaf_mask) {
+		for (uint8_t i = 0; i < packet_size; i++) {
+			if (!(leaf_mask & (1 << i)))
+				continue;
+
+			auto hit = triangles[index].intersect(rays[i]);
+
+			if (hit.has_hit() && hit.distance < max_distances[i]) {
+				nearest_hits[i] = { hit.distance, hit.barycentric, index };
+				max_distances[i] = hit.distance;
+			}
+		}
+	});
+
+	return nearest_hits;
+}
+
+void mesh_bvh::save(std::ostream &stream) const {
+	util::write_array(stream, bvh.nodes);
+	util::write_array(stream, bvh.indices);
+	util::write_array(stream, triangles);
+}
+
+void mesh_bvh::load(std::span<const std::byte> data) {
+	util::read_array(data, bvh.nodes);
+	util::read_array(data, bvh.indices);
+	util::read_array(data, triangles);
+}
+
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "pch.hpp"
+
+#include "core/accelerator.hpp"
+#include "core/bvh4.hpp"
+#include "geometry/ray.hpp"
+#include "geometry/triangle.hpp"
+
+namespace core {
+
+// Alternative to kd_tree that references every triangle exactly once
+class mesh_bvh : public accelerator {
+public:
+	core::bvh4 bvh;
+
+	// Triangle positions in mesh order
+	std::vector<geometry::triangle> triangles;
+
+	void build(const std::vector<geometry::triangle> &triangles,
+			uint32_t bin_count = 16, uint32_t max_leaf_size = 4);
+
+	intersection intersect(const geometry::ray &ray, uint8_t visualize_depth = 0) const override;
+
+	bool occluded(const geometry::ray &ray, float max_distance) const override;
+
+	std::array<intersection, geometry::packet_size> intersect_packet(
+			const geometry::ray_packet &rays, int mask) const override;
+
+	void save(std::ostream &stream) const override;
+
+	void load(std::span<const std::byte> data) override;
+};
+
+}
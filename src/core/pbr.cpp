@@ -123,21 +123,30 @@ static float distribution_lambert(
 	return cos_theta / math::pi;
 }
 
-static float distribution_ggx(
+// Density of microfacet normals, importance_ggx() picks halfway vectors in proportion to it times their cosine
+static float ndf_ggx(
 		const fvec3 &normal,
-		const fvec3 &outcoming,
-		const fvec3 &incoming,
+		const fvec3 &halfway,
 		float roughness) {
 	roughness *= roughness;
 	roughness *= roughness;
 
-	fvec3 halfway = normalize(outcoming + incoming);
 	float cos_phi = dot(normal, halfway);
 
 	float denom = lerp(1, roughness, cos_phi * cos_phi);
 
+	return roughness / math::max(math::pi * denom * denom, math::epsilon);
+}
+
+static float distribution_ggx(
+		const fvec3 &normal,
+		const fvec3 &outcoming,
+		const fvec3 &incoming,
+		float roughness) {
+	fvec3 halfway = normalize(outcoming + incoming);
+
 	float cos_theta = dot(normal, incoming);
-	return cos_theta * roughness / math::max(math::pi * denom * denom, math::epsilon);
+	return cos_theta * ndf_ggx(normal, halfway, roughness);
 }
 
 // Public API
@@ -164,13 +173,13 @@ fvec3 importance_specular(
 	return importance_ggx(rand, normal, outcoming, roughness);
 }
 
-float pdf_diffuse(
+float brdf_diffuse(
 		const fvec3 &normal,
 		const fvec3 &incoming) {
 	return distribution_lambert(normal, incoming);
 }
 
-float pdf_specular(
+float brdf_specular(
 		const fvec3 &normal,
 		const fvec3 &outcoming,
 		const fvec3 &incoming,
@@ -184,4 +193,24 @@ float pdf_specular(
 	return (dist * geo) / math::max(4 * n_dot_o * n_dot_i, math::epsilon);
 }
 
+float pdf_diffuse(
+		const fvec3 &normal,
+		const fvec3 &incoming) {
+	return distribution_lambert(normal, incoming);
+}
+
+float pdf_specular(
+		const fvec3 &normal,
+		const fvec3 &outcoming,
+		const fvec3 &incoming,
+		float roughness) {
+	fvec3 halfway = normalize(outcoming + incoming);
+
+	// Reflecting about the halfway vector squeezes the density by the Jacobian 1 / (4 * o . h)
+	float n_dot_h = dot(normal, halfway);
+	float o_dot_h = dot(outcoming, halfway);
+
+	return ndf_ggx(normal, halfway, roughness) * n_dot_h / math::max(4 * o_dot_h, math::epsilon);
+}
+
 }
@@ -30,6 +30,20 @@ math::fvec3 importance_specular(
 		const math::fvec3 &outcoming,
 		float roughness);
 
+// BRDFs are multiplied by the cosine of the incoming angle, the diffuse one is missing the albedo
+
+float brdf_diffuse(
+		const math::fvec3 &normal,
+		const math::fvec3 &incoming);
+
+float brdf_specular(
+		const math::fvec3 &normal,
+		const math::fvec3 &outcoming,
+		const math::fvec3 &incoming,
+		float roughness);
+
+// Solid angle densities of the directions picked by importance_diffuse() and importance_specular()
+
 float pdf_diffuse(
 		const math::fvec3 &normal,
 		const math::fvec3 &incoming);
@@ -1,9 +1,12 @@
 #include "core/renderer.hpp"
 
+#include "core/checkpoint_writer.hpp"
+#include "core/framebuffer.hpp"
 #include "core/material.hpp"
 #include "core/mesh.hpp"
 #include "core/pbr.hpp"
 #include "geometry/ray.hpp"
+#include "geometry/ray_packet.hpp"
 #include "image/image.hpp"
 #include "image/image_texture.hpp"
 #include "math/vec2.hpp"
@@ -13,9 +16,14 @@
 #include "scene/camera.hpp"
 #include "scene/entity.hpp"
 #include "scene/model.hpp"
+#include "scene/point_light.hpp"
+#include "scene/spot_light.hpp"
 #include "scene/sun_light.hpp"
 #include "scene/transform.hpp"
+#include "util/hash.hpp"
+#include "util/mapped_file.hpp"
 #include "util/rand_cone_vec.hpp"
+#include "util/serialization.hpp"
 #include "util/thread_pool.hpp"
 
 using namespace geometry;
@@ -24,18 +32,50 @@ using namespace scene;
 
 namespace core {
 
-static float rand() {
-	static std::mt19937 rng{std::random_device{}()};
-	static std::uniform_real_distribution<float> dist(0, 1);
-
-	return dist(rng);
-}
-
-static fvec3 rand_sphere_dir() {
-	float s = rand() * 2 * math::pi;
-	float t = rand() * 2 - 1;
+// Rays passed to intersect() by the current thread, used for throughput stats
+static thread_local uint64_t traced_ray_count = 0;
+
+static constexpr char state_magic[4] = { 'R', 'S', 'T', 'A' };
+
+// Bump whenever the layout of the state file changes, so that older states are not resumed from
+static constexpr uint32_t state_version = 1;
+
+// Leads the raw accumulation state that a render can be resumed from
+struct state_header {
+	char magic[4];
+	uint32_t version;
+	uint64_t key; // Renders with different keys produce different images
+	uint32_t next_sample; // First sample that has not been drawn yet
+	uint32_t padding;
+};
+
+// Offsets into the sample dimensions of every path vertex
+enum : uint32_t {
+	opacity_dimension = 0,
+	lobe_dimension = 1,
+	sun_dimension = 2, // 2D
+	indirect_dimension = 4, // 2D
+	roulette_dimension = 6,
+	emitter_dimension = 7,
+	emitter_point_dimension = 8, // 2D
+	environment_dimension = 10, // 2D
+	environment_point_dimension = 12, // 2D
+	light_dimension = 14,
+	emitter_alias_dimension = 15
+};
+
+// Interleaves the bits of both coordinates, so that sorting by the code follows a Z-order curve
+static uint32_t morton_code(const uvec2 &position) {
+	auto spread_bits = [] (uint32_t value) {
+		value &= 0x0000FFFF;
+		value = (value | (value << 8)) & 0x00FF00FF;
+		value = (value | (value << 4)) & 0x0F0F0F0F;
+		value = (value | (value << 2)) & 0x33333333;
+		value = (value | (value << 1)) & 0x55555555;
+		return value;
+	};
 
-	return fvec3(math::sin(s), math::cos(s), t) / math::sqrt(t * t + 1);
+	return spread_bits(position.x) | (spread_bits(position.y) << 1);
 }
 
 static fvec2 equirectangular_proj(const fvec3 &dir) {
@@ -45,6 +85,22 @@ static fvec2 equirectangular_proj(const fvec3 &dir) {
 	);
 }
 
+// Inverse of equirectangular_proj()
+static fvec3 equirectangular_unproj(const fvec2 &coord) {
+	float azimuth = (coord.x - 0.5F) * 2 * math::pi;
+	float elevation = (coord.y - 0.5F) * math::pi;
+
+	return fvec3(
+		math::cos(elevation) * math::cos(azimuth),
+		math::sin(elevation),
+		math::cos(elevation) * math::sin(azimuth)
+	);
+}
+
+static float get_luminance(const fvec3 &color) {
+	return dot(color, fvec3(0.2126F, 0.7152F, 0.0722F));
+}
+
 static fvec3 tonemap_approx_aces(const fvec3 &hdr) {
 	constexpr float a = 2.51F;
 	constexpr fvec3 b(0.03F);
@@ -54,10 +110,148 @@ static fvec3 tonemap_approx_aces(const fvec3 &hdr) {
 	return saturate((hdr * (a * hdr + b)) / (hdr * (c * hdr + d) + e));
 }
 
+// Sample counts are saved relative to max_sample_count, only if sample_count_path is not empty
+static void save_framebuffer(util::thread_pool &pool, const framebuffer &framebuffer,
+		const std::filesystem::path &path, const std::filesystem::path &sample_count_path, uint32_t max_sample_count) {
+	uvec2 resolution = framebuffer.get_size();
+
+	image::image img(resolution, 4, false, true);
+	image::image sample_count_img(resolution, 1, false, false);
+
+	// The framebuffer is read in the order it is laid out in, a row at a time by each thread
+	pool.parallel_for(resolution.y, [&] (uint32_t y) {
+		for (uint32_t x = 0; x < resolution.x; x++) {
+			uvec2 pixel(x, y);
+			size_t index = framebuffer.get_index(pixel);
+
+			fvec4 average = framebuffer.get_average(index);
+			fvec3 color = tonemap_approx_aces(fvec3(average));
+
+			img.write(pixel, 0, color.x);
+			img.write(pixel, 1, color.y);
+			img.write(pixel, 2, color.z);
+			img.write(pixel, 3, average.w);
+
+			if (!sample_count_path.empty())
+				sample_count_img.write(pixel, 0, static_cast<float>(framebuffer.get_sample_count(index)) / max_sample_count);
+		}
+	});
+
+	img.save(path);
+
+	if (!sample_count_path.empty())
+		sample_count_img.save(sample_count_path);
+}
+
+static fvec3 get_emission(const core::material &material, const fvec2 &tex_coord) {
+	return material.get_emissive(tex_coord) * 10; // DEBUG
+}
+
+// Weight of a sample from the first strategy, when the second one could have produced it too
+static float power_heuristic(float pdf, float other_pdf) {
+	return pdf * pdf / (pdf * pdf + other_pdf * other_pdf);
+}
+
 static fvec3 reflect(const fvec3 &incident, const fvec3 &normal) {
 	return incident - 2 * dot(normal, incident) * normal;
 }
 
+// Diffuse and specular lobes mixed by Fresnel
+struct brdf_eval {
+	fvec3 brdf;
+	fvec3 fresnel;
+	fvec3 diffuse_brdf, specular_brdf;
+	float diffuse_pdf, specular_pdf;
+};
+
+static brdf_eval eval_brdf(
+		const fvec3 &normal, const fvec3 &outcoming, const fvec3 &incoming,
+		const fvec3 &albedo, float roughness, float metallic) {
+	// Diffuse BRDF
+
+	float diffuse_pdf = pbr::pdf_diffuse(normal, incoming);
+	fvec3 diffuse_brdf = pbr::brdf_diffuse(normal, incoming) * albedo;
+
+	// Specular BRDF
+
+	float specular_pdf = pbr::pdf_specular(normal, outcoming, incoming, roughness);
+	fvec3 specular_brdf(pbr::brdf_specular(normal, outcoming, incoming, roughness));
+
+	// Fresnel
+
+	fvec3 fresnel = lerp(fvec3(0.04F), albedo, metallic);
+	{
+		fvec3 halfway = normalize(outcoming + incoming);
+		float cos_theta = dot(outcoming, halfway);
+
+		fresnel = lerp(fresnel, fvec3::one, math::pow(1 - cos_theta, 5));
+	}
+
+	// Final BRDF
+
+	diffuse_brdf = lerp(diffuse_brdf, fvec3::zero, metallic); // Metallic should realistically be either 1 or 0
+	fvec3 brdf = lerp(diffuse_brdf, specular_brdf, fresnel);
+
+	return { brdf, fresnel, diffuse_brdf, specular_brdf, diffuse_pdf, specular_pdf };
+}
+
+// Written under a temporary name and renamed into place, so that a write cut short never replaces a good state
+static void save_state(const std::filesystem::path &path, const state_header &header,
+		const framebuffer &framebuffer, const std::vector<uint8_t> &converged) {
+	std::filesystem::path temp_path = path;
+	temp_path += ".tmp";
+
+	{
+		std::ofstream stream(temp_path, std::ios::binary);
+		util::write_value(stream, header);
+		framebuffer.save(stream);
+		util::write_array(stream, converged);
+
+		if (!stream)
+			throw std::runtime_error("Failed to write " + temp_path.string() + ".");
+	}
+
+	std::filesystem::rename(temp_path, path);
+}
+
+// Leaves the framebuffer and the convergence mask untouched unless the whole state matches the expected header
+static bool load_state(const std::filesystem::path &path, const state_header &expected, uint32_t &next_sample,
+		framebuffer &framebuffer, std::vector<uint8_t> &converged) {
+	if (!std::filesystem::exists(path))
+		return false;
+
+	try {
+		util::mapped_file file(path);
+		std::span<const std::byte> data = file.get_data();
+
+		state_header header;
+		util::read_value(data, header);
+
+		if (std::memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0
+				|| header.version != expected.version || header.key != expected.key) {
+			std::cout << "Ignoring the state of a different render." << std::endl;
+			return false;
+		}
+
+		core::framebuffer loaded_framebuffer(framebuffer.get_size());
+		loaded_framebuffer.load(data);
+
+		std::vector<uint8_t> loaded_converged;
+		util::read_array(data, loaded_converged);
+
+		if (loaded_converged.size() != converged.size())
+			throw std::runtime_error("Convergence mask size does not match.");
+
+		framebuffer = std::move(loaded_framebuffer);
+		converged = std::move(loaded_converged);
+		next_sample = header.next_sample;
+		return true;
+	} catch (const std::exception &e) {
+		std::cout << "Ignoring a broken render state: " << e.what() << std::endl;
+		return false;
+	}
+}
+
 static std::shared_ptr<image::texture> get_cached_texture(const std::filesystem::path &path, bool srgb) {
 	static std::unordered_map<std::string, std::weak_ptr<image::texture>> texture_cache;
 
@@ -212,12 +406,23 @@ void renderer::load_gltf(const std::filesystem::path &path) {
 			mesh->triangles[i].z = indices[2];
 		}
 
-		mesh->recalculate_aabb();
-		mesh->build_kd_tree();
-
 		surfaces.push_back({ mesh, materials[ai_mesh->mMaterialIndex] });
 	}
 
+	// Meshes are independent, so build their accelerators concurrently
+	auto build_start = std::chrono::steady_clock::now();
+
+	if (!accelerator_cache_directory.empty())
+		std::filesystem::create_directories(accelerator_cache_directory);
+
+	util::thread_pool::common_pool.parallel_for(surfaces.size(), [&] (uint32_t i) {
+		surfaces[i].mesh->recalculate_aabb();
+		surfaces[i].mesh->build_accelerator(mesh_accelerator, accelerator_cache_directory);
+	});
+
+	std::chrono::duration<float> build_time = std::chrono::steady_clock::now() - build_start;
+	std::cout << "Built mesh accelerators in " << build_time.count() << " s." << std::endl;
+
 	// We will instantiate just one camera
 
 	if (ai_scene->mNumCameras < camera_index + 1)
@@ -238,6 +443,16 @@ void renderer::load_gltf(const std::filesystem::path &path) {
 	}
 	skip_sun_light:
 
+	// Point and spot lights are instantiated on the nodes with their names
+	std::unordered_map<std::string, const aiLight *> ai_punctual_lights;
+	for (uint32_t i = 0; i < ai_scene->mNumLights; i++) {
+		const aiLight *ai_light = ai_scene->mLights[i];
+
+		if (ai_light->mType == aiLightSourceType::aiLightSource_POINT
+				|| ai_light->mType == aiLightSourceType::aiLightSource_SPOT)
+			ai_punctual_lights[ai_light->mName.C_Str()] = ai_light;
+	}
+
 	// Instantiate nodes
 	std::stack<std::tuple<entity *, aiNode *>> stack;
 	stack.push({ nullptr, ai_scene->mRootNode });
@@ -300,6 +515,22 @@ void renderer::load_gltf(const std::filesystem::path &path) {
 			// Assimp 5.2.2 does not support directional light radii
 		}
 
+		if (auto it = ai_punctual_lights.find(entity->get_name()); it != ai_punctual_lights.end()) {
+			const aiLight *ai_light = it->second;
+			fvec3 energy(ai_light->mColorDiffuse.r, ai_light->mColorDiffuse.g, ai_light->mColorDiffuse.b);
+
+			// Lights are not attenuated by any other law than the inverse square one
+			if (ai_light->mType == aiLightSourceType::aiLightSource_POINT) {
+				auto point_light = entity->add_component<scene::point_light>();
+				point_light->energy = energy;
+			} else {
+				auto spot_light = entity->add_component<scene::spot_light>();
+				spot_light->energy = energy;
+				spot_light->inner_cone_angle = ai_light->mAngleInnerCone;
+				spot_light->outer_cone_angle = ai_light->mAngleOuterCone;
+			}
+		}
+
 		// Queue children up for instantiation
 
 		aiNode **ai_children = ai_node->mChildren;
@@ -320,98 +551,559 @@ void renderer::load_gltf(const std::filesystem::path &path) {
 		throw std::runtime_error("Scene is missing a camera.");
 }
 
-void renderer::render(const std::filesystem::path &path) const {
+void renderer::take_snapshot() {
+	snapshot.instances.clear();
+	snapshot.punctual_lights.clear();
+
+	std::vector<geometry::aabb> bounds;
+
+	std::stack<entity *> stack;
+	stack.push(root.get());
+
+	while (!stack.empty()) {
+		entity *entity = stack.top();
+		stack.pop();
+
+		for (const auto &child : entity->get_children())
+			stack.push(child.get());
+
+		if (auto model = entity->get_component<scene::model>()) {
+			const transform &transform = entity->get_global_transform();
+
+			// Normals will have to be normalized if transform applies scale
+			fmat3 normal_matrix = transpose(inverse(transform.basis));
+
+			snapshot.instances.push_back({ model.get(), transform, transform.inverse(), normal_matrix });
+			bounds.push_back(model->aabb.transform(transform));
+		}
+
+		if (auto point_light = entity->get_component<scene::point_light>()) {
+			snapshot.punctual_lights.push_back({
+				entity->get_global_transform().origin,
+				point_light->energy,
+				fvec3::zero,
+				-1, -1
+			});
+		}
+
+		if (auto spot_light = entity->get_component<scene::spot_light>()) {
+			const transform &transform = entity->get_global_transform();
+
+			snapshot.punctual_lights.push_back({
+				transform.origin,
+				spot_light->energy,
+				normalize(transform.basis * fvec3::forward),
+				math::cos(spot_light->inner_cone_angle),
+				math::cos(spot_light->outer_cone_angle)
+			});
+		}
+	}
+
+	snapshot.instance_bvh.build(bounds);
+
+	std::vector<fvec3> light_positions;
+	std::vector<float> light_powers;
+	for (const punctual_light &light : snapshot.punctual_lights) {
+		light_positions.push_back(light.position);
+		light_powers.push_back(get_luminance(light.energy));
+	}
+
+	snapshot.light_bvh.build(light_positions, light_powers);
+
+	// Emissive triangles are gathered in world space, so that they can be sampled without walking the scene
+	snapshot.emitters.clear();
+	std::vector<float> emitter_weights;
+
+	for (uint32_t instance_index = 0; instance_index < snapshot.instances.size(); instance_index++) {
+		instance &instance = snapshot.instances[instance_index];
+		const auto &surfaces = instance.model->surfaces;
+
+		instance.first_emitters.assign(surfaces.size(), no_emitter);
+
+		for (uint32_t surface_index = 0; surface_index < surfaces.size(); surface_index++) {
+			const model::surface &surface = surfaces[surface_index];
+			const core::mesh &mesh = *surface.mesh;
+
+			if (math::max(surface.material->emissive_fac.x, surface.material->emissive_fac.y, surface.material->emissive_fac.z) <= 0)
+				continue;
+
+			instance.first_emitters[surface_index] = snapshot.emitters.size();
+
+			for (uint32_t triangle_index = 0; triangle_index < mesh.triangles.size(); triangle_index++) {
+				const uvec3 &indices = mesh.triangles[triangle_index];
+				const vertex &v1 = mesh.vertices[indices.x];
+				const vertex &v2 = mesh.vertices[indices.y];
+				const vertex &v3 = mesh.vertices[indices.z];
+
+				fvec3 edge_normal = cross(
+						instance.transform * v2.position - instance.transform * v1.position,
+						instance.transform * v3.position - instance.transform * v1.position);
+				float area = length(edge_normal) / 2;
+
+				snapshot.emitters.push_back({
+					instance_index,
+					&surface,
+					triangle_index,
+					area,
+					area > 0 ? edge_normal / (area * 2) : fvec3::zero
+				});
+
+				// Textured emission is approximated by its value at the centroid
+				fvec2 centroid = (v1.tex_coord + v2.tex_coord + v3.tex_coord) / 3;
+				emitter_weights.push_back(area * get_luminance(get_emission(*surface.material, centroid)));
+			}
+		}
+	}
+
+	snapshot.emitter_table = util::alias_table(emitter_weights);
+
+	snapshot.environment_table = {};
+	snapshot.environment_size = uvec2(0);
+
+	if (auto texture = std::dynamic_pointer_cast<image::image_texture>(environment)) {
+		uvec2 size = texture->get_image()->get_size();
+		std::vector<float> environment_weights(size.x * size.y);
+
+		// Rows near the poles cover less of the sphere, the bottom row of the image is at -90 degrees
+		for (uint32_t y = 0; y < size.y; y++) {
+			float v = 1 - (y + 0.5F) / size.y;
+			float cos_elevation = math::cos((v - 0.5F) * math::pi);
+
+			for (uint32_t x = 0; x < size.x; x++) {
+				fvec2 coord((x + 0.5F) / size.x, v);
+				environment_weights[y * size.x + x] = get_luminance(fvec3(texture->sample(coord))) * cos_elevation;
+			}
+		}
+
+		snapshot.environment_table = util::alias_table(environment_weights);
+		snapshot.environment_size = size;
+	}
+
+	snapshot.sampler = sampler.get();
+
+	snapshot.camera_transform = camera->get_entity()->get_global_transform();
+
+	snapshot.has_sun_light = sun_light != nullptr;
+	if (sun_light) {
+		snapshot.sun_direction = normalize(sun_light->get_entity()->get_global_transform().basis * fvec3::backward);
+		snapshot.sun_energy = sun_light->energy;
+		snapshot.sun_angular_radius = sun_light->angular_radius;
+		snapshot.sun_cos_angular_radius = math::cos(sun_light->angular_radius);
+		snapshot.sun_solid_angle = 2 * math::pi * (1 - snapshot.sun_cos_angular_radius);
+	}
+}
+
+uint64_t renderer::get_state_key() const {
+	uint64_t key = util::hash(&resolution, sizeof(resolution));
+
+	auto add = [&key] (const auto &value) {
+		key = util::hash(&value, sizeof(value), key);
+	};
+
+	// Shared resources are hashed once and their hashes reused
+	std::unordered_map<const void *, uint64_t> resource_hashes;
+
+	// Image textures are told apart by their pixels, other kinds only by being there
+	auto add_texture = [&] (const std::shared_ptr<image::texture> &texture) {
+		add(texture != nullptr);
+
+		auto image_texture = std::dynamic_pointer_cast<image::image_texture>(texture);
+		if (!image_texture)
+			return;
+
+		const image::image &img = *image_texture->get_image();
+		auto [it, inserted] = resource_hashes.try_emplace(&img);
+
+		if (inserted) {
+			std::span<const uint8_t> data = img.get_data();
+			uvec2 size = img.get_size();
+			uint32_t format[] = { img.get_channel_count(), img.is_hdr(), img.is_srgb() };
+
+			it->second = util::hash(data.data(), data.size());
+			it->second = util::hash(&size, sizeof(size), it->second);
+			it->second = util::hash(format, sizeof(format), it->second);
+		}
+
+		add(it->second);
+	};
+
+	add(bounce_count);
+	add(roulette_bounce_count);
+	add(transparent_skip_count);
+	add(transparent_background);
+
+	add(adaptive_threshold);
+	add(adaptive_min_samples);
+	add(environment_factor);
+	add_texture(environment);
+	add(visualize_kd_tree_depth);
+	add(snapshot.sampler->get_key());
+
+	add(snapshot.camera_transform.origin);
+	add(snapshot.camera_transform.basis);
+	add(camera->get_fov());
+
+	add(snapshot.has_sun_light);
+	if (snapshot.has_sun_light) {
+		add(snapshot.sun_direction);
+		add(snapshot.sun_energy);
+		add(snapshot.sun_angular_radius);
+	}
+
+	for (const punctual_light &light : snapshot.punctual_lights) {
+		add(light.position);
+		add(light.energy);
+		add(light.direction);
+		add(light.cos_inner_cone_angle);
+		add(light.cos_outer_cone_angle);
+	}
+
+	for (const instance &instance : snapshot.instances) {
+		add(instance.transform.origin);
+		add(instance.transform.basis);
+
+		// Meshes are hashed the same way as for the accelerator cache
+		for (const model::surface &surface : instance.model->surfaces) {
+			auto [it, inserted] = resource_hashes.try_emplace(surface.mesh.get());
+			if (inserted)
+				it->second = surface.mesh->get_hash();
+			add(it->second);
+
+			const core::material &material = *surface.material;
+			add(material.albedo_fac);
+			add(material.opacity_fac);
+			add(material.roughness_fac);
+			add(material.metallic_fac);
+			add(material.emissive_fac);
+			add(material.ior);
+			add(material.shadow_catcher);
+
+			add_texture(material.normal_tex);
+			add_texture(material.albedo_tex);
+			add_texture(material.opacity_tex);
+			add_texture(material.occlusion_tex);
+			add_texture(material.roughness_tex);
+			add_texture(material.metallic_tex);
+			add_texture(material.emissive_tex);
+		}
+	}
+
+	return key;
+}
+
+void renderer::render(const std::filesystem::path &path) {
+	// Global transforms are cached lazily, so they must not be computed by the worker threads
+	take_snapshot();
+
 	util::thread_pool pool(thread_count);
 
-	std::vector<std::shared_ptr<util::future>> todo;
-	todo.reserve(resolution.y);
+	// Samples are counted per pixel, because converged pixels stop receiving them
+	core::framebuffer framebuffer(resolution);
+	std::vector<uint8_t> converged(resolution.x * resolution.y, false);
 
-	// Claiming pixels by opaque samples is needed for proper transparent background blending
-	struct pixel {
-		math::fvec3 color;
-		float alpha;
-		bool claimed;
+	// Consecutive tiles are close to each other on the screen, so they share more of the scene
+	std::vector<uvec2> tiles;
+	for (uint32_t y = 0; y < resolution.y; y += tile_size) {
+		for (uint32_t x = 0; x < resolution.x; x += tile_size)
+			tiles.emplace_back(x, y);
+	}
+
+	std::sort(tiles.begin(), tiles.end(), [] (const uvec2 &a, const uvec2 &b) {
+		return morton_code(a / tile_size) < morton_code(b / tile_size);
+	});
+
+	auto blend = [&] (uint32_t x, uint32_t y, const fvec4 &data) {
+		// Noise is estimated as it will be seen
+		float luminance = get_luminance(tonemap_approx_aces(fvec3(data)));
+		framebuffer.add_sample(framebuffer.get_index(uvec2(x, y)), data, luminance);
 	};
 
-	std::vector<std::vector<pixel>> pixels;
-	pixels.resize(resolution.x);
-	for (auto &column : pixels)
-		column.resize(resolution.y, { fvec3::zero, 0, false });
+	// Draws a range of samples of a whole tile at once, tiles never overlap so no locking is needed
+	auto render_tile = [&] (const uvec2 &tile, uint32_t first_sample, uint32_t end_sample) {
+		uvec2 tile_end = math::min(tile + uvec2(tile_size), resolution);
 
-	auto img = std::make_shared<image::image>(resolution, 4, false, true);
+		// Neighbouring primary rays are intersected together
+		bool use_packets = bounce_count > 0 && !visualize_kd_tree_depth;
 
-	for (uint32_t sample = 0; sample < sample_count; sample++) {
-		std::cout << "Drawing sample " << sample + 1 << " out of " << sample_count << '.' << std::endl;
+		for (uint32_t sample = first_sample; sample < end_sample; sample++) {
+			for (uint32_t y = tile.y; y < tile_end.y; y++) {
+				for (uint32_t packet_x = tile.x; packet_x < tile_end.x; packet_x += packet_size) {
+					// Lanes past the end of the tile repeat the last pixel and stay disabled
+					static_assert(packet_size == 4);
+					uint32_t last_x = tile_end.x - 1;
 
-		for (uint32_t y = 0; y < resolution.y; y++) {
-			todo.push_back(pool.submit([&, y] (uint32_t) {
-				for (uint32_t x = 0; x < resolution.x; x++) {
-					uvec2 pixel(x, y);
+					uint32_t lane_count = math::min(tile_end.x - packet_x, static_cast<uint32_t>(packet_size));
 
-					// Do not offset the first sample so we can get a consistent alpha mask for smart blending
-					fvec2 aa_offset = fvec2(rand(), rand());
+					// Converged pixels are left out
+					int mask = 0;
+					for (uint8_t i = 0; i < lane_count; i++) {
+						if (!converged[framebuffer.get_index(uvec2(packet_x + i, y))])
+							mask |= 1 << i;
+					}
 
-					fvec2 ndc = ((fvec2(pixel) + aa_offset) /
-							resolution) * 2 - fvec2::one;
-					ndc.y = -ndc.y;
-					float ratio = static_cast<float>(resolution.x) / resolution.y;
+					if (mask == 0)
+						continue;
 
-					ray ray = camera->get_ray(ndc, ratio);
-					fvec4 data = trace(bounce_count, ray);
+					std::array<sample_stream, packet_size> streams;
+					for (uint8_t i = 0; i < packet_size; i++)
+						streams[i] = get_sample_stream(uvec2(math::min(packet_x + i, last_x), y), sample);
 
-					// Smart blending - needed for transparent background
-					if (transparent_background) {
-						if (data.w > 0.5 && !pixels[x][y].claimed) {
-							// If an opaque sample will claim this pixel
-							pixels[x][y].color = fvec3(data); // Overwrite the color
-							pixels[x][y].alpha = 1 / (sample + 1); // And blend the alpha
-							pixels[x][y].claimed = true; // Mark the pixel as claimed
-							continue;
-						} else if (data.w < 0.5 && pixels[x][y].claimed) {
-							// If a transparent sample encounters a claimed pixel
-							pixels[x][y].alpha = pixels[x][y].alpha * sample + data.w; // Blend only alpha
-							pixels[x][y].alpha /= sample + 1;
-							continue;
-						} else if (data.w < 0.5) {
-							// If transparent sample blends with an unclaimed pixel
-							// Do nothing and preserve the default transparent black color
+					ray_packet rays = {
+						get_camera_ray(uvec2(packet_x, y), streams[0]),
+						get_camera_ray(uvec2(math::min(packet_x + 1, last_x), y), streams[1]),
+						get_camera_ray(uvec2(math::min(packet_x + 2, last_x), y), streams[2]),
+						get_camera_ray(uvec2(math::min(packet_x + 3, last_x), y), streams[3])
+					};
+
+					std::array<intersect_result, packet_size> results;
+					if (use_packets)
+						results = intersect_packet(rays, mask);
+
+					for (uint8_t i = 0; i < lane_count; i++) {
+						if (!(mask & (1 << i)))
 							continue;
-						}
-					}
 
-					// Otherwise if an opaque sample blends with a claimed pixel (or transparent background is disabled)
-					pixels[x][y].color = pixels[x][y].color * sample + fvec3(data); // Blend color
-					pixels[x][y].color /= sample + 1;
-					pixels[x][y].alpha = pixels[x][y].alpha * sample + data.w; // Blend alpha
-					pixels[x][y].alpha /= sample + 1;
+						fvec4 data = use_packets ?
+								shade(rays[i], results[i], streams[i]) :
+								trace(rays[i], streams[i]);
+
+						blend(packet_x + i, y, data);
+					}
 				}
-			}));
+			}
 		}
+	};
 
-		for (auto &future : todo)
-			future->wait();
+	// The state is saved next to the image, with every checkpoint
+	std::filesystem::path state_path = path;
+	state_path.replace_extension(".state");
 
-		todo.clear();
+	state_header header {};
+	std::memcpy(header.magic, state_magic, sizeof(header.magic));
+	header.version = state_version;
+
+	// Hashing the environment image takes a while, so it is only done when the key is going to be used
+	if (resumable)
+		header.key = get_state_key();
+
+	uint32_t first_sample = 0;
+
+	if (resumable && load_state(state_path, header, first_sample, framebuffer, converged))
+		std::cout << "Resuming from sample " << first_sample + 1 << '.' << std::endl;
+
+	// Pixels and tiles that still have not converged
+	std::vector<uvec2> active_pixels;
+	std::vector<uvec2> active_tiles = tiles;
+
+	for (uint32_t y = 0; y < resolution.y; y++) {
+		for (uint32_t x = 0; x < resolution.x; x++)
+			active_pixels.emplace_back(x, y);
+	}
 
-		if (sample != 0 && sample % 5 == 0 || sample == sample_count - 1) {
-			std::cout << "Saving..." << std::endl;
+	auto remove_converged = [&] {
+		std::erase_if(active_pixels, [&] (const uvec2 &position) {
+			return converged[framebuffer.get_index(position)];
+		});
 
-			for (uint32_t y = 0; y < resolution.y; y++) {
-				for (uint32_t x = 0; x < resolution.x; x++) {
-					fvec3 color = tonemap_approx_aces(pixels[x][y].color);
-					float alpha = pixels[x][y].alpha;
+		std::erase_if(active_tiles, [&] (const uvec2 &tile) {
+			uvec2 tile_end = math::min(tile + uvec2(tile_size), resolution);
 
-					uvec2 pixel(x, y);
-					img->write(pixel, 0, color.x);
-					img->write(pixel, 1, color.y);
-					img->write(pixel, 2, color.z);
-					img->write(pixel, 3, alpha);
+			for (uint32_t y = tile.y; y < tile_end.y; y++) {
+				for (uint32_t x = tile.x; x < tile_end.x; x++) {
+					if (!converged[framebuffer.get_index(uvec2(x, y))])
+						return false;
 				}
 			}
 
-			img->save(path);
+			return true;
+		});
+	};
+
+	remove_converged();
+
+	// Debug output with the number of samples each pixel received, relative to sample_count
+	std::filesystem::path sample_count_path;
+	if (save_sample_count) {
+		sample_count_path = path;
+		sample_count_path.replace_filename(path.stem().string() + "-samples" + path.extension().string());
+	}
+
+	checkpoint_writer writer;
+
+	// Only a copy of the framebuffer is handed over, which can be taken while no samples are being added
+	auto make_save = [&] (uint32_t next_sample) {
+		auto framebuffer_copy = std::make_shared<core::framebuffer>(framebuffer);
+		auto converged_copy = std::make_shared<std::vector<uint8_t>>(converged);
+
+		state_header state = header;
+		state.next_sample = next_sample;
+
+		return [=, this, max_sample_count = sample_count] (util::thread_pool &pool) {
+			save_framebuffer(pool, *framebuffer_copy, path, sample_count_path, max_sample_count);
+
+			if (resumable)
+				save_state(state_path, state, *framebuffer_copy, *converged_copy);
+		};
+	};
+
+	auto render_start = std::chrono::steady_clock::now();
+	auto last_checkpoint = render_start;
+
+	auto is_out_of_time = [&] {
+		std::chrono::duration<float> render_time = std::chrono::steady_clock::now() - render_start;
+		return time_budget > 0 && render_time.count() >= time_budget;
+	};
+
+	// Threads only have to meet once the pass ending at end_sample is due for a check, a checkpoint or the final save
+	auto is_sync_due = [&] (uint32_t end_sample) {
+		if (end_sample >= sample_count || target_error > 0)
+			return true;
+
+		if (adaptive_threshold > 0 && end_sample >= adaptive_min_samples)
+			return true;
+
+		// A checkpoint could not be handed over while the previous one is being saved
+		std::chrono::duration<float> checkpoint_age = std::chrono::steady_clock::now() - last_checkpoint;
+		return checkpoint_age.count() >= checkpoint_interval && !writer.busy();
+	};
+
+	bool done = false;
+
+	while (first_sample < sample_count && !active_pixels.empty() && !done) {
+		uint32_t end_sample;
+
+		std::cout << "Drawing samples from " << first_sample + 1 << " out of " << sample_count << '.' << std::endl;
+
+		auto pass_start = std::chrono::steady_clock::now();
+
+		// Summed up from all threads once they run out of work
+		std::atomic<uint64_t> ray_count = 0;
+
+		// Tree visualization is only supported by the recursive integrator
+		if (wavefront && bounce_count > 0 && !visualize_kd_tree_depth) {
+			end_sample = math::min(first_sample + pass_size, sample_count);
+
+			for (uint32_t sample = first_sample; sample < end_sample && !is_out_of_time(); sample++)
+				ray_count += trace_wavefront(pool, sample, active_pixels, blend);
+		} else {
+			// Threads keep claiming a tile for one pass at a time, going on with the next pass without waiting for the others
+			std::mutex claim_mutex;
+			uint32_t next_item = 0;
+			bool stopped = false;
+			end_sample = first_sample;
+
+			// Passes of a tile are still drawn in order, so that the sums do not depend on thread timing
+			std::vector<std::atomic<uint32_t>> tile_passes(active_tiles.size());
+
+			auto claim = [&] (uint32_t &tile, uint32_t &pass) {
+				std::unique_lock lock(claim_mutex);
+
+				// Once out of time, the remaining tiles are left with fewer samples, which pixels keep track of
+				if (stopped || is_out_of_time())
+					return false;
+
+				tile = next_item % active_tiles.size();
+				pass = next_item / active_tiles.size();
+
+				if (tile == 0 && pass > 0 && is_sync_due(end_sample)) {
+					stopped = true;
+					return false;
+				}
+
+				if (tile == 0)
+					end_sample = math::min(first_sample + (pass + 1) * pass_size, sample_count);
+
+				next_item++;
+				return true;
+			};
+
+			std::vector<std::shared_ptr<util::future>> workers;
+			workers.reserve(pool.thread_count());
+
+			for (uint32_t i = 0; i < pool.thread_count(); i++) {
+				workers.push_back(pool.submit([&] (uint32_t) {
+					uint64_t start_ray_count = traced_ray_count;
+
+					for (uint32_t tile, pass; claim(tile, pass);) {
+						// Only happens when a tile comes around again before its previous pass is done
+						for (uint32_t passes; (passes = tile_passes[tile]) < pass;)
+							tile_passes[tile].wait(passes);
+
+						uint32_t pass_first_sample = first_sample + pass * pass_size;
+						render_tile(active_tiles[tile], pass_first_sample, math::min(pass_first_sample + pass_size, sample_count));
+
+						tile_passes[tile]++;
+						tile_passes[tile].notify_all();
+					}
+
+					ray_count += traced_ray_count - start_ray_count;
+				}));
+			}
+
+			for (auto &worker : workers)
+				worker->wait();
+		}
+
+		std::chrono::duration<float> pass_time = std::chrono::steady_clock::now() - pass_start;
+		std::cout << "Drew samples up to " << end_sample << ", tracing " << ray_count / pass_time.count() * 1e-6F << " million rays per second." << std::endl;
+
+		// Pixels are only marked as converged between passes, so the result does not depend on thread timing
+		if (adaptive_threshold > 0 && end_sample >= adaptive_min_samples) {
+			// Rare bright paths might have been missed by a single pixel, but not by its whole neighbourhood
+			for (const uvec2 &position : active_pixels) {
+				uvec2 min = uvec2(math::max(position.x, 1U) - 1, math::max(position.y, 1U) - 1);
+				uvec2 max = math::min(position + uvec2(2), resolution);
+
+				float error = 0;
+				for (uint32_t y = min.y; y < max.y; y++) {
+					for (uint32_t x = min.x; x < max.x; x++)
+						error = math::max(error, framebuffer.get_standard_error(framebuffer.get_index(uvec2(x, y))));
+				}
+
+				converged[framebuffer.get_index(position)] = error < adaptive_threshold;
+			}
+
+			remove_converged();
+
+			std::cout << active_pixels.size() << " pixels have not converged yet." << std::endl;
+		}
+
+		// Stop at whichever criterion is met first, the sample count is checked by the loop
+
+		if (is_out_of_time()) {
+			std::cout << "Time budget of " << time_budget << " s has run out." << std::endl;
+			done = true;
+		}
+
+		if (target_error > 0) {
+			double error_sum = 0;
+
+			// Dark pixels would dominate the mean otherwise
+			for (size_t i = 0; i < converged.size(); i++)
+				error_sum += framebuffer.get_standard_error(i) / math::max(framebuffer.get_luminance_mean(i), 0.01F);
+
+			float error = error_sum / (resolution.x * resolution.y);
+			std::cout << "Mean relative error is " << error << '.' << std::endl;
+
+			if (error <= target_error)
+				done = true;
+		}
+
+		// A checkpoint still being written is not waited for, the next sync will try again
+		std::chrono::duration<float> checkpoint_age = std::chrono::steady_clock::now() - last_checkpoint;
+		if (checkpoint_age.count() >= checkpoint_interval && writer.try_submit(make_save(end_sample))) {
+			std::cout << "Saving a checkpoint in the background..." << std::endl;
+			last_checkpoint = std::chrono::steady_clock::now();
 		}
+
+		first_sample = end_sample;
 	}
+
+	std::cout << "Saving..." << std::endl;
+
+	// Nothing is rendering anymore, so the final save gets the whole pool
+	writer.wait();
+	make_save(first_sample)(pool);
 }
 
 fvec3 renderer::intersect_result::get_normal() const {
@@ -421,23 +1113,237 @@ fvec3 renderer::intersect_result::get_normal() const {
 	return tbn * material->get_normal(tex_coord);
 }
 
-fvec4 renderer::trace(uint8_t bounce, const ray &ray) const {
-	if (bounce == 0)
+sample_stream renderer::get_sample_stream(const uvec2 &pixel, uint32_t sample) const {
+	return sample_stream(*snapshot.sampler, pixel.y * resolution.x + pixel.x, sample);
+}
+
+ray renderer::get_camera_ray(const uvec2 &pixel, sample_stream &stream) const {
+	float ratio = static_cast<float>(resolution.x) / resolution.y;
+
+	// Do not offset the first sample so we can get a consistent alpha mask for smart blending
+	fvec2 aa_offset = stream.get_2d(0);
+
+	fvec2 ndc = ((fvec2(pixel) + aa_offset) /
+			resolution) * 2 - fvec2::one;
+	ndc.y = -ndc.y;
+
+	return camera->get_ray(ndc, ratio, snapshot.camera_transform);
+}
+
+struct renderer::path_state {
+	geometry::ray ray;
+	uint8_t bounce; // Bounces left
+	uint32_t transparent_skips = 0;
+	bool active = true;
+
+	// Radiance reaching the camera is the sum of everything found along the path times the throughput at that point
+	fvec3 throughput = fvec3::one;
+	fvec3 radiance = fvec3::zero;
+	float alpha = 1;
+
+	intersect_result result;
+
+	// Density of the bounce that led to the current vertex, 0 if light sampling could not have found it
+	float bsdf_pdf = 0;
+
+	// Light found along an unoccluded shadow ray
+	struct shadow_query {
+		geometry::ray ray;
+		float max_distance;
+		fvec3 radiance;
+	};
+
+	// Queued by shade_path(), the sun goes first
+	std::array<shadow_query, 4> shadow_queries;
+	uint8_t shadow_query_count;
+	bool catcher; // Terminates the path if the first shadow ray is occluded
+	fvec3 emissive;
+
+	geometry::ray next_ray;
+	bool has_next;
+	uint8_t next_bounce;
+	fvec3 next_factor;
+	float next_pdf;
+
+	sample_stream stream;
+
+	path_state(const geometry::ray &ray, uint8_t bounce, const sample_stream &stream) :
+			ray(ray), bounce(bounce), stream(stream) {}
+};
+
+fvec4 renderer::trace(const ray &ray, sample_stream &stream) const {
+	if (bounce_count == 0)
 		return fvec4::future;
 
-	auto result = intersect(ray);
+	return shade(ray, intersect(ray), stream);
+}
+
+fvec4 renderer::shade(const ray &ray, const intersect_result &result, sample_stream &stream) const {
+	path_state path(ray, bounce_count, stream);
+	path.result = result;
+
+	while (true) {
+		shade_path(path);
+		advance_path(path);
+
+		if (!path.active)
+			break;
+
+		path.result = intersect(path.ray);
+	}
+
+	return fvec4(path.radiance, path.alpha);
+}
+
+uint64_t renderer::trace_wavefront(util::thread_pool &pool, uint32_t sample,
+		std::span<const uvec2> pixels,
+		const std::function<void(uint32_t, uint32_t, const fvec4 &)> &write) const {
+	// Paths in flight, big enough to keep every thread busy until the last bounces
+	static constexpr uint32_t batch_size = 1 << 16;
+	static constexpr uint32_t chunk_size = 256;
+
+	std::atomic<uint64_t> ray_count = 0;
+
+	auto for_each_chunk = [&] (uint32_t count, const std::function<void(uint32_t, uint32_t)> &stage) {
+		pool.parallel_for((count + chunk_size - 1) / chunk_size, [&] (uint32_t chunk) {
+			uint64_t chunk_start_ray_count = traced_ray_count;
+
+			uint32_t begin = chunk * chunk_size;
+			stage(begin, math::min(begin + chunk_size, count));
+
+			ray_count += traced_ray_count - chunk_start_ray_count;
+		});
+	};
+
+	std::vector<path_state> paths;
+	paths.reserve(batch_size);
+
+	// Indices of the paths that are still being traced
+	std::vector<uint32_t> active;
+	active.reserve(batch_size);
+
+	uint32_t pixel_count = pixels.size();
+
+	for (uint32_t batch_start = 0; batch_start < pixel_count; batch_start += batch_size) {
+		uint32_t batch_end = math::min(batch_start + batch_size, pixel_count);
+
+		// Camera rays are generated in the order of the pixels, so that neighbours form coherent packets
+		paths.clear();
+		for (uint32_t i = batch_start; i < batch_end; i++) {
+			const uvec2 &pixel = pixels[i];
+			sample_stream stream = get_sample_stream(pixel, sample);
+			paths.emplace_back(get_camera_ray(pixel, stream), bounce_count, stream);
+		}
+
+		active.resize(paths.size());
+		std::iota(active.begin(), active.end(), 0);
+
+		for (bool primary = true; !active.empty(); primary = false) {
+			uint32_t active_count = active.size();
+
+			// Extend
+
+			for_each_chunk(active_count, [&] (uint32_t begin, uint32_t end) {
+				uint32_t i = begin;
+
+				if (primary) {
+					static_assert(packet_size == 4);
+
+					for (; i + packet_size <= end; i += packet_size) {
+						ray_packet rays = {
+							paths[active[i]].ray,
+							paths[active[i + 1]].ray,
+							paths[active[i + 2]].ray,
+							paths[active[i + 3]].ray
+						};
+
+						auto results = intersect_packet(rays, full_packet_mask);
+						for (uint8_t lane = 0; lane < packet_size; lane++)
+							paths[active[i + lane]].result = std::move(results[lane]);
+					}
+				}
+
+				for (; i < end; i++)
+					paths[active[i]].result = intersect(paths[active[i]].ray);
+			});
+
+			// Grouping by material lets neighbouring paths share textures, misses go first
+
+			std::sort(active.begin(), active.end(), [&] (uint32_t a, uint32_t b) {
+				return std::less<const core::material *>()(
+						paths[a].result.material,
+						paths[b].result.material);
+			});
+
+			// Shade
+
+			for_each_chunk(active_count, [&] (uint32_t begin, uint32_t end) {
+				for (uint32_t i = begin; i < end; i++)
+					shade_path(paths[active[i]]);
+			});
+
+			// Trace shadow rays and continue
+
+			for_each_chunk(active_count, [&] (uint32_t begin, uint32_t end) {
+				for (uint32_t i = begin; i < end; i++)
+					advance_path(paths[active[i]]);
+			});
+
+			// Compact
+
+			std::erase_if(active, [&] (uint32_t index) {
+				return !paths[index].active;
+			});
+		}
+
+		for (uint32_t i = batch_start; i < batch_end; i++) {
+			const path_state &path = paths[i - batch_start];
+			write(pixels[i].x, pixels[i].y, fvec4(path.radiance, path.alpha));
+		}
+	}
+
+	return ray_count;
+}
+
+void renderer::shade_path(path_state &path) const {
+	const intersect_result &result = path.result;
+	sample_stream &stream = path.stream;
+	fvec3 dir = path.ray.get_dir();
+
+	stream.next_vertex();
+
+	path.shadow_query_count = 0;
+	path.catcher = false;
+	path.emissive = fvec3::zero;
+	path.has_next = false;
 
 	if (!result.hit) {
-		float alpha = transparent_background ? 0 : 1;
+		fvec3 environment_color = get_environment(dir);
 
-		if (environment)
-			return fvec4(fvec3(environment->sample(equirectangular_proj(ray.get_dir()))) * environment_factor, alpha);
-		else
-			return fvec4(environment_factor, alpha);
+		// Weighted against the chance of the previous vertex having sampled the environment directly
+		if (path.bsdf_pdf > 0 && !snapshot.environment_table.empty())
+			environment_color *= power_heuristic(path.bsdf_pdf, get_environment_pdf(dir));
+
+		// The sun disk is hidden from the camera, only its light shows
+		if (snapshot.has_sun_light && snapshot.sun_solid_angle > 0 && path.bounce < bounce_count
+				&& math::dot(dir, snapshot.sun_direction) >= snapshot.sun_cos_angular_radius) {
+			float weight = path.bsdf_pdf > 0 ? power_heuristic(path.bsdf_pdf, 1 / snapshot.sun_solid_angle) : 1;
+			environment_color += snapshot.sun_energy / snapshot.sun_solid_angle * weight;
+		}
+
+		path.radiance += path.throughput * environment_color;
+		if (path.bounce == bounce_count)
+			path.alpha = transparent_background ? 0 : 1;
+
+		path.active = false;
+		return;
 	}
 
-	if (visualize_kd_tree_depth)
-		return fvec4(result.position, 1);
+	if (visualize_kd_tree_depth) {
+		path.radiance = result.position;
+		path.active = false;
+		return;
+	}
 
 	// Material properties
 
@@ -445,207 +1351,330 @@ fvec4 renderer::trace(uint8_t bounce, const ray &ray) const {
 	float opacity = result.material->get_opacity(result.tex_coord);
 	float roughness = result.material->get_roughness(result.tex_coord);
 	float metallic = result.material->get_metallic(result.tex_coord);
-	fvec3 emissive = result.material->get_emissive(result.tex_coord) * 10; // DEBUG
+	fvec3 emissive = get_emission(*result.material, result.tex_coord);
 	float ior = result.material->ior;
 
+	geometry::ray opacity_ray(
+		result.position + dir * math::epsilon,
+		dir
+	);
+
 	// Handle opacity
-	if (!math::is_approx(opacity, 1) && rand() > opacity) {
-		geometry::ray opacity_ray(
-			result.position + ray.get_dir() * math::epsilon,
-			ray.get_dir()
-		);
-		return trace(bounce, opacity_ray);
+	if (!math::is_approx(opacity, 1) && stream.get(opacity_dimension) > opacity) {
+		// Passing through does not use up a bounce, so stacks of alpha-tested leaves need a limit of their own
+		if (path.transparent_skips++ >= transparent_skip_count) {
+			path.active = false;
+			return;
+		}
+
+		path.next_ray = opacity_ray;
+		path.next_bounce = path.bounce;
+		path.next_factor = fvec3::one;
+		path.next_pdf = 0;
+		path.has_next = true;
+		return;
 	}
 
 	fvec3 normal = result.get_normal();
-	fvec3 outcoming = -ray.get_dir();
+	fvec3 outcoming = -dir;
 
 	// With smooth shading the outcoming vector may point under the surface
-	if (math::dot(normal, outcoming) <= 0)
-		return fvec4::future;
-		// outcoming = reflect(outcoming, normal); // Do not use this
-		// We cannot correct the outcoming vector because that will result in rays getting trapped in a surface
-		// A new ray might intersect at its starting point and get reflected back to it multiple times
-
-	// Correct the roughness
-
-	roughness = math::max(roughness, 0.05F); // Small roughness might cause precision artifacts
+	if (math::dot(normal, outcoming) <= 0) {
+		path.active = false;
+		return;
+	}
 
-	// Are we going to sample specular or diffuse BRDF lobe?
+	roughness = math::max(roughness, 0.05F);
 
 	float specular_probability = pbr::fresnel(outcoming, reflect(-outcoming, normal), ior);
 	specular_probability = math::max(specular_probability, metallic);
-	bool specular_sample = core::rand() < specular_probability;
+	bool specular_sample = stream.get(lobe_dimension) < specular_probability;
 
 	// Direct Lighting
 
-	fvec3 direct_out;
+	if (snapshot.has_sun_light) {
+		// Uniform over the solid angle of the disk
+		fvec2 sun_rand = stream.get_2d(sun_dimension);
+		float cos_theta = lerp(1, snapshot.sun_cos_angular_radius, sun_rand.y);
+		fvec3 direct_incoming = util::rand_cone_vec(sun_rand.x, cos_theta, snapshot.sun_direction);
 
-	if (sun_light) {
-		fvec3 direct_incoming = sun_light->get_entity()->get_global_transform().basis * fvec3::backward;
-		direct_incoming = util::rand_cone_vec(rand(), math::cos(rand() * sun_light->angular_radius), direct_incoming);
-
-		// Sunlight lobe might intersect with the surface, so let's avoid that
 		if (math::dot(normal, direct_incoming) > 0) {
-			geometry::ray direct_ray(
+			auto &query = path.shadow_queries[path.shadow_query_count++];
+			query.ray = geometry::ray(
 				result.position + direct_incoming * math::epsilon,
 				direct_incoming
 			);
-			auto direct_result = intersect(direct_ray);
-
-			if (!direct_result.hit) {
-				// If a shadow catcher is not in shadow, treat it as if it was fully transparent
-				if (result.material->shadow_catcher && bounce == bounce_count) {
-					geometry::ray opacity_ray(
-						result.position + ray.get_dir() * math::epsilon,
-						ray.get_dir()
-					);
-					return trace(bounce, opacity_ray);
+			query.max_distance = std::numeric_limits<float>::max();
+			query.radiance = fvec3::zero;
+
+			// A lit shadow catcher is passed through, a shadowed one ends the path
+			if (result.material->shadow_catcher && path.bounce == bounce_count) {
+				if (path.transparent_skips++ >= transparent_skip_count) {
+					path.active = false;
+					return;
 				}
 
-				// Diffuse BRDF
+				path.catcher = true;
+				path.next_ray = opacity_ray;
+				path.next_bounce = path.bounce;
+				path.next_factor = fvec3::one;
+				path.next_pdf = 0;
+				path.has_next = true;
+				return;
+			}
 
-				float diffuse_pdf = pbr::pdf_diffuse(normal, direct_incoming);
-				fvec3 diffuse_brdf = diffuse_pdf * albedo;
+			auto eval = eval_brdf(normal, outcoming, direct_incoming,
+					albedo, roughness, metallic);
+			float bsdf_pdf = lerp(eval.diffuse_pdf, eval.specular_pdf, specular_probability);
 
-				// Specular BRDF
+			// Radiance over the density of the disk is just the energy
+			float weight = path.bounce > 1 && snapshot.sun_solid_angle > 0 ?
+					power_heuristic(1 / snapshot.sun_solid_angle, bsdf_pdf) : 1;
+			query.radiance = eval.brdf * snapshot.sun_energy * weight;
+		}
+	}
+
+	// Emitters are sampled directly and weighted against finding them by a bounce, which the last vertex does not get
+	if (!snapshot.emitter_table.empty()) {
+		uint32_t index = snapshot.emitter_table.sample(
+				stream.get(emitter_dimension), stream.get(emitter_alias_dimension));
+		const emitter &emitter = snapshot.emitters[index];
+
+		// Uniformly distributed over the triangle
+		fvec2 point_rand = stream.get_2d(emitter_point_dimension);
+		float root = math::sqrt(point_rand.x);
+		fvec3 barycentric(1 - root, root * (1 - point_rand.y), root * point_rand.y);
+
+		intersect_result light = interpolate(
+				{ 0, emitter.surface, emitter.triangle_index, barycentric },
+				&snapshot.instances[emitter.instance_index]);
+
+		fvec3 to_light = light.position - result.position;
+		float distance = length(to_light);
+		fvec3 light_incoming = to_light / distance;
+
+		// Emitters only light up the side their normal faces
+		if (distance > 0 && math::dot(normal, light_incoming) > 0 && math::dot(light.get_normal(), light_incoming) < 0) {
+			float light_pdf = get_emitter_pdf(index, result.position, light.position);
+
+			auto eval = eval_brdf(normal, outcoming, light_incoming,
+					albedo, roughness, metallic);
+			float bsdf_pdf = lerp(eval.diffuse_pdf, eval.specular_pdf, specular_probability);
+
+			float weight = path.bounce > 1 ? power_heuristic(light_pdf, bsdf_pdf) : 1;
+
+			if (light_pdf > 0) {
+				auto &query = path.shadow_queries[path.shadow_query_count++];
+				query.ray = geometry::ray(
+					result.position + light_incoming * math::epsilon,
+					light_incoming
+				);
+
+				// The emitter itself must not count as an occluder
+				query.max_distance = distance * 0.999F - math::epsilon;
+				query.radiance = eval.brdf * get_emission(*light.material, light.tex_coord) * weight / light_pdf;
+			}
+		}
+	}
 
-				float specular_pdf = pbr::pdf_specular(normal, outcoming, direct_incoming, roughness);
-				fvec3 specular_brdf(specular_pdf);
+	// Point and spot lights cannot be hit by a bounce, so they are only ever sampled directly
+	if (!snapshot.light_bvh.empty()) {
+		auto importance = [&] (uint32_t index) {
+			const punctual_light &light = snapshot.punctual_lights[index];
+			fvec3 to_light = light.position - result.position;
+			float distance_squared = math::max(math::dot(to_light, to_light), math::epsilon);
 
-				// Fresnel
+			return get_luminance(get_punctual_intensity(light, result.position)) / distance_squared;
+		};
 
-				fvec3 fresnel = lerp(fvec3(0.04F), albedo, metallic);
-				{
-					fvec3 halfway = normalize(outcoming + direct_incoming);
-					float cos_theta = dot(outcoming, halfway);
+		uint32_t index;
+		float probability;
 
-					fresnel = lerp(fresnel, fvec3::one, math::pow(1 - cos_theta, 5));
-				}
+		if (snapshot.light_bvh.sample(result.position, stream.get(light_dimension), importance, index, probability)) {
+			const punctual_light &light = snapshot.punctual_lights[index];
 
-				// Final BRDF
+			fvec3 to_light = light.position - result.position;
+			float distance = length(to_light);
+			fvec3 light_incoming = to_light / distance;
 
-				diffuse_brdf = lerp(diffuse_brdf, fvec3::zero, metallic); // Metallic should realistically be either 1 or 0
-				fvec3 brdf = lerp(diffuse_brdf, specular_brdf, fresnel);
+			if (distance > 0 && math::dot(normal, light_incoming) > 0) {
+				auto eval = eval_brdf(normal, outcoming, light_incoming,
+						albedo, roughness, metallic);
 
-				// Final PDF
+				auto &query = path.shadow_queries[path.shadow_query_count++];
+				query.ray = geometry::ray(
+					result.position + light_incoming * math::epsilon,
+					light_incoming
+				);
+				query.max_distance = distance - math::epsilon;
+				query.radiance = eval.brdf * get_punctual_intensity(light, result.position)
+						/ (distance * distance * probability);
+			}
+		}
+	}
 
-				// !00% chance of hitting the sun
-				diffuse_pdf = 1;
-				specular_pdf = 1;
-				float pdf = lerp(diffuse_pdf, specular_pdf, specular_probability);
+	if (!snapshot.environment_table.empty()) {
+		fvec3 environment_incoming = sample_environment(
+				stream.get_2d(environment_dimension),
+				stream.get_2d(environment_point_dimension));
 
-				fvec3 direct_in = sun_light->energy;
-				direct_out = brdf * direct_in / math::max(pdf, math::epsilon);
-				direct_out = math::clamp(direct_out, fvec3::zero, direct_in);
-			} else {
-				// If a shadow catcher is in shadow, return zero
-				if (result.material->shadow_catcher && bounce == bounce_count)
-					return fvec4::future;
+		if (math::dot(normal, environment_incoming) > 0) {
+			float environment_pdf = get_environment_pdf(environment_incoming);
+
+			auto eval = eval_brdf(normal, outcoming, environment_incoming,
+					albedo, roughness, metallic);
+			float bsdf_pdf = lerp(eval.diffuse_pdf, eval.specular_pdf, specular_probability);
+
+			float weight = path.bounce > 1 ? power_heuristic(environment_pdf, bsdf_pdf) : 1;
+
+			if (environment_pdf > 0) {
+				auto &query = path.shadow_queries[path.shadow_query_count++];
+				query.ray = geometry::ray(
+					result.position + environment_incoming * math::epsilon,
+					environment_incoming
+				);
+				query.max_distance = std::numeric_limits<float>::max();
+				query.radiance = eval.brdf * get_environment(environment_incoming) * weight / environment_pdf;
 			}
 		}
 	}
 
-	// Indirect Lighting
+	// Emission found by a bounce is weighted against the chance of the previous vertex having sampled it directly
+	if (path.bsdf_pdf > 0 && result.emitter != no_emitter) {
+		float light_pdf = get_emitter_pdf(result.emitter, path.ray.origin, result.position);
+		emissive *= power_heuristic(path.bsdf_pdf, light_pdf);
+	}
+
+	path.emissive = emissive;
 
-	fvec3 indirect_out;
+	// Indirect Lighting
 
-	// Importance sampling
+	if (path.bounce <= 1)
+		return;
 
-	fvec2 rand(core::rand(), core::rand());
+	fvec2 rand = stream.get_2d(indirect_dimension);
 	fvec3 indirect_incoming = specular_sample ?
 			pbr::importance_specular(rand, normal, outcoming, roughness) :
 			pbr::importance_diffuse(rand, normal, outcoming);
 
-	// Specular BRDF lobe might intersect with the surface, so let's avoid that
 	if (math::dot(normal, indirect_incoming) > 0) {
-		// Diffuse BRDF
-
-		float diffuse_pdf = pbr::pdf_diffuse(normal, indirect_incoming);
-		fvec3 diffuse_brdf = diffuse_pdf * albedo;
+		auto eval = eval_brdf(normal, outcoming, indirect_incoming,
+				albedo, roughness, metallic);
+		float pdf = lerp(eval.diffuse_pdf, eval.specular_pdf, specular_probability);
 
-		// Specular BRDF
+		path.next_ray = geometry::ray(
+			result.position + indirect_incoming * math::epsilon,
+			indirect_incoming
+		);
+		path.next_bounce = path.bounce - 1;
 
-		float specular_pdf = pbr::pdf_specular(normal, outcoming, indirect_incoming, roughness);
-		fvec3 specular_brdf(specular_pdf);
+		path.next_factor = eval.brdf / math::max(pdf, math::epsilon);
+		path.next_pdf = pdf;
+		path.has_next = true;
+	}
+}
 
-		// Fresnel
+void renderer::advance_path(path_state &path) const {
+	if (!path.active)
+		return;
 
-		fvec3 fresnel = lerp(fvec3(0.04F), albedo, metallic);
-		{
-			fvec3 halfway = normalize(outcoming + indirect_incoming);
-			float cos_theta = dot(outcoming, halfway);
+	for (uint8_t i = 0; i < path.shadow_query_count; i++) {
+		const auto &query = path.shadow_queries[i];
 
-			fresnel = lerp(fresnel, fvec3::one, math::pow(1 - cos_theta, 5));
+		if (!occluded(query.ray, query.max_distance)) {
+			path.radiance += path.throughput * query.radiance;
+		} else if (path.catcher && i == 0) {
+			path.active = false;
+			return;
 		}
+	}
 
-		// Final BRDF
-
-		diffuse_brdf = lerp(diffuse_brdf, fvec3::zero, metallic); // Metallic should realistically be either 1 or 0
-		fvec3 brdf = lerp(diffuse_brdf, specular_brdf, fresnel);
-
-		// Final PDF
-
-		float pdf = lerp(diffuse_pdf, specular_pdf, specular_probability);
-
-		// Next bounce
+	path.radiance += path.throughput * path.emissive;
 
-		geometry::ray indirect_ray(
-			result.position + indirect_incoming * math::epsilon,
-			indirect_incoming
-		);
+	if (!path.has_next) {
+		path.active = false;
+		return;
+	}
 
-		// This division by PDF partially cancels out with the BRDF
-		fvec3 indirect_in = fvec3(trace(bounce - 1, indirect_ray));
-		indirect_out = brdf * indirect_in / math::max(pdf, math::epsilon);
+	bool bounced = path.next_bounce < path.bounce;
 
-		// We refuse to return more than what was given and this prevents hot pixels
-		indirect_out = math::clamp(indirect_out, fvec3::zero, indirect_in);
+	path.ray = path.next_ray;
+	path.bounce = path.next_bounce;
+	path.throughput *= path.next_factor;
+	path.bsdf_pdf = path.next_pdf;
 
-		// if (pdf == 0) {
-		if (std::isnan(math::length(indirect_out))) {
-		// if (math::any(indirect_out > fvec3(1000))) {
-			float n_dot_o = dot(normal, outcoming);
-			float n_dot_i = dot(normal, indirect_incoming);
+	// Russian roulette, paths that could not add much are ended at random and the survivors make up for them
+	if (bounced && bounce_count - path.bounce >= roulette_bounce_count) {
+		float survival_probability = math::min(math::max(path.throughput.x, path.throughput.y, path.throughput.z), 1.0F);
 
-			std::cout << "NaN value at outcoming: " << outcoming << " indirect_incoming: " << indirect_incoming << " brdf: " << brdf << std::endl;
-			std::cout << "fresnel: " << fresnel << " diffuse_brdf: " << diffuse_brdf << " specular_brdf: " << specular_brdf << std::endl;
-			std::cout << "n_dot_o: " << n_dot_o << " n_dot_i: " << n_dot_i << " bounce: " << static_cast<uint32_t>(bounce) << std::endl;
-			std::cout << "position: " << result.position << " pdf: " << pdf << " indirect_in: " << indirect_in << " indirect_out: " << indirect_out << std::endl;
-			std::cout << "diffuse_pdf: " << diffuse_pdf << " specular_pdf: " << specular_pdf << " roughness: " << roughness << std::endl;
-			std::cout << std::endl;
+		if (path.stream.get(roulette_dimension) >= survival_probability) {
+			path.active = false;
+			return;
 		}
-	}
 
-	return fvec4(direct_out + indirect_out + emissive, 1);
+		path.throughput /= survival_probability;
+	}
 }
 
 renderer::intersect_result renderer::intersect(const ray &ray) const {
-	std::stack<entity *> stack;
-	stack.push(root.get());
+	traced_ray_count++;
 
 	model::intersection nearest_hit;
+	const instance *nearest_instance = nullptr;
+	float max_distance = std::numeric_limits<float>::max();
 
-	while (!stack.empty()) {
-		entity *entity = stack.top();
-		stack.pop();
+	snapshot.instance_bvh.intersect(ray, max_distance, [&] (uint32_t index) {
+		const instance &instance = snapshot.instances[index];
 
-		for (const auto &child : entity->get_children())
-			stack.push(child.get());
+		auto hit = instance.model->intersect(ray,
+				instance.transform, instance.inv_transform,
+				visualize_kd_tree_depth);
 
-		if (auto model = entity->get_component<scene::model>()) {
-			auto hit = model->intersect(ray, visualize_kd_tree_depth);
+		if (hit.has_hit() && hit.distance < max_distance) {
+			nearest_hit = hit;
+			nearest_instance = &instance;
+			max_distance = hit.distance;
+		}
 
-			if (!hit.has_hit())
-				continue;
+		return false;
+	});
+
+	return interpolate(nearest_hit, nearest_instance);
+}
 
-			if (hit.distance < nearest_hit.distance
-					|| !nearest_hit.has_hit()) {
-				nearest_hit = hit;
+std::array<renderer::intersect_result, packet_size> renderer::intersect_packet(
+		const ray_packet &rays, int mask) const {
+	traced_ray_count += std::popcount(static_cast<uint32_t>(mask));
+
+	std::array<model::intersection, packet_size> nearest_hits;
+	std::array<const instance *, packet_size> nearest_instances = {};
+	std::array<float, packet_size> max_distances;
+	max_distances.fill(std::numeric_limits<float>::max());
+
+	snapshot.instance_bvh.intersect_packet(rays, mask, max_distances, [&] (uint32_t index, int leaf_mask) {
+		const instance &instance = snapshot.instances[index];
+
+		auto hits = instance.model->intersect_packet(rays,
+				instance.transform, instance.inv_transform,
+				leaf_mask);
+
+		for (uint8_t i = 0; i < packet_size; i++) {
+			if (hits[i].has_hit() && hits[i].distance < max_distances[i]) {
+				nearest_hits[i] = hits[i];
+				nearest_instances[i] = &instance;
+				max_distances[i] = hits[i].distance;
 			}
 		}
-	}
+	});
+
+	std::array<intersect_result, packet_size> results;
+	for (uint8_t i = 0; i < packet_size; i++)
+		results[i] = interpolate(nearest_hits[i], nearest_instances[i]);
 
+	return results;
+}
+
+renderer::intersect_result renderer::interpolate(const model::intersection &nearest_hit, const instance *instance) const {
 	if (!nearest_hit.has_hit())
 		return { false };
 
@@ -660,17 +1689,20 @@ renderer::intersect_result renderer::intersect(const ray &ray) const {
 		};
 	}
 
-	const auto &mesh     = nearest_hit.surface->mesh;
-	const auto &material = nearest_hit.surface->material;
+	const core::mesh *mesh         = nearest_hit.surface->mesh.get();
+	const core::material *material = nearest_hit.surface->material.get();
 
-	uvec3 &indices = mesh->triangles[nearest_hit.triangle_index];
+	const uvec3 &indices = mesh->triangles[nearest_hit.triangle_index];
 	auto &v1 = mesh->vertices[indices.x];
 	auto &v2 = mesh->vertices[indices.y];
 	auto &v3 = mesh->vertices[indices.z];
 
-	// Normals will have to be normalized if transform applies scale
-	transform transform = nearest_hit.transform;
-	fmat3 normal_matrix = transpose(inverse(nearest_hit.transform.basis));
+	const transform &transform = instance->transform;
+	const fmat3 &normal_matrix = instance->normal_matrix;
+
+	uint32_t emitter = instance->first_emitters[nearest_hit.surface - instance->model->surfaces.data()];
+	if (emitter != no_emitter)
+		emitter += nearest_hit.triangle_index;
 
 	fvec3 position = transform * (
 			v1.position  * nearest_hit.barycentric.x +
@@ -695,8 +1727,85 @@ renderer::intersect_result renderer::intersect(const ray &ray) const {
 		position,
 		tex_coord,
 		normal,
-		tangent
+		tangent,
+		emitter
 	};
 }
 
+fvec3 renderer::get_environment(const fvec3 &dir) const {
+	if (environment)
+		return fvec3(environment->sample(equirectangular_proj(dir))) * environment_factor;
+	else
+		return environment_factor;
+}
+
+fvec3 renderer::sample_environment(const fvec2 &rand, const fvec2 &point_rand) const {
+	const uvec2 &size = snapshot.environment_size;
+	uint32_t index = snapshot.environment_table.sample(rand.x, rand.y);
+
+	fvec2 pixel(index % size.x, index / size.x);
+	fvec2 coord((pixel.x + point_rand.x) / size.x, 1 - (pixel.y + point_rand.y) / size.y);
+
+	return equirectangular_unproj(coord);
+}
+
+float renderer::get_environment_pdf(const fvec3 &dir) const {
+	const uvec2 &size = snapshot.environment_size;
+	fvec2 coord = equirectangular_proj(dir);
+
+	uint32_t x = math::min(static_cast<uint32_t>(coord.x * size.x), size.x - 1);
+	uint32_t y = math::min(static_cast<uint32_t>((1 - coord.y) * size.y), size.y - 1);
+
+	// Density over the image divided by the area the mapping stretches it to
+	float cos_elevation = math::sqrt(math::max(1 - dir.y * dir.y, 0.0F));
+	float image_pdf = snapshot.environment_table.get_probability(y * size.x + x) * size.x * size.y;
+
+	return image_pdf / math::max(2 * math::pi * math::pi * cos_elevation, math::epsilon);
+}
+
+fvec3 renderer::get_punctual_intensity(const punctual_light &light, const fvec3 &position) const {
+	if (light.cos_outer_cone_angle <= -1)
+		return light.energy;
+
+	// Falloff between the cones as suggested by KHR_lights_punctual
+	float cos_angle = math::dot(light.direction, normalize(position - light.position));
+	float scale = 1 / math::max(light.cos_inner_cone_angle - light.cos_outer_cone_angle, 0.001F);
+	float falloff = saturate((cos_angle - light.cos_outer_cone_angle) * scale);
+
+	return light.energy * (falloff * falloff);
+}
+
+float renderer::get_emitter_pdf(uint32_t index, const fvec3 &origin, const fvec3 &position) const {
+	float probability = snapshot.emitter_table.get_probability(index);
+	if (probability == 0)
+		return 0;
+
+	const emitter &emitter = snapshot.emitters[index];
+
+	fvec3 to_emitter = position - origin;
+	float distance_squared = dot(to_emitter, to_emitter);
+	float cos_theta = math::abs(dot(emitter.normal, to_emitter)) / math::sqrt(distance_squared);
+
+	// Points are picked uniformly by area
+	return probability * distance_squared / math::max(emitter.area * cos_theta, math::epsilon);
+}
+
+bool renderer::occluded(const ray &ray, float max_distance) const {
+	traced_ray_count++;
+
+	bool occluded = false;
+
+	snapshot.instance_bvh.intersect(ray, max_distance, [&] (uint32_t index) {
+		const instance &instance = snapshot.instances[index];
+
+		occluded = instance.model->occluded(ray,
+				instance.transform, instance.inv_transform,
+				max_distance);
+
+		return occluded;
+	});
+
+	return occluded;
+}
+
 }
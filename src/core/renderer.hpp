@@ -2,24 +2,48 @@
 
 #include "pch.hpp"
 
+#include "core/accelerator.hpp"
+#include "core/bvh4.hpp"
+#include "core/light_bvh.hpp"
 #include "core/material.hpp"
+#include "core/sampler.hpp"
+#include "geometry/ray_packet.hpp"
 #include "image/texture.hpp"
+#include "math/mat3.hpp"
 #include "math/vec2.hpp"
 #include "math/vec3.hpp"
 #include "scene/camera.hpp"
 #include "scene/entity.hpp"
+#include "scene/model.hpp"
+#include "scene/point_light.hpp"
+#include "scene/spot_light.hpp"
 #include "scene/sun_light.hpp"
+#include "scene/transform.hpp"
+#include "util/alias_table.hpp"
+#include "util/thread_pool.hpp"
 
 namespace core {
 
 class renderer {
 public:
 	static constexpr uint32_t no_sun_light = static_cast<uint32_t>(-1);
+	static constexpr uint32_t no_emitter = static_cast<uint32_t>(-1);
+	static constexpr uint32_t tile_size = 32;
 
 	math::uvec2 resolution = math::fvec2(1920, 1080);
 	uint32_t thread_count = 0;
 	uint32_t sample_count = 10000;
+	uint32_t pass_size = 8; // Samples drawn into a tile at a time, stopping criteria and checkpoints are checked between passes
+	float checkpoint_interval = 10; // Seconds between saves, which are written in the background, the final image is always saved
+	float adaptive_threshold = 0; // Pixels stop receiving samples once the standard error of their displayed luminance drops below it, 0 = disabled
+	uint32_t adaptive_min_samples = 16; // Convergence is first checked at the end of the pass that reaches it
+	float time_budget = 0; // Seconds, rendering stops as soon as it runs out, 0 = unlimited
+	float target_error = 0; // Rendering stops once the mean relative error of pixels drops below it, 0 = disabled
+	bool resumable = false; // Raw samples are saved as <name>.state with every checkpoint, and a render of the same scene goes on from them
+	bool save_sample_count = false; // Also saves a grayscale image with the number of samples spent on each pixel, named <name>-samples<ext>
 	uint8_t bounce_count = 4;
+	uint8_t roulette_bounce_count = 3; // Bounces after which paths with low throughput start to be ended at random, which keeps the expected result
+	uint32_t transparent_skip_count = 64; // Transparent surfaces a path may pass through, they do not use up bounces
 	std::shared_ptr<scene::entity> root;
 	std::shared_ptr<scene::camera> camera;
 	std::shared_ptr<scene::sun_light> sun_light;
@@ -28,29 +52,151 @@ public:
 	bool transparent_background = false;
 	uint32_t camera_index = 0; // TODO Move to load_gltf
 	uint32_t sun_light_index = 0; // TODO Move to load_gltf
-	uint8_t visualize_kd_tree_depth = 0; // 0 = disabled
+	uint8_t visualize_kd_tree_depth = 0; // 0 = disabled, needs mesh_accelerator set to kd_tree
+	accelerator_type mesh_accelerator = accelerator_type::bvh; // Primary ray packets are only traced together through BVHs
+	bool wavefront = false; // Trace paths in batches, one bounce at a time
+	std::filesystem::path accelerator_cache_directory; // Empty = always rebuild
+	std::shared_ptr<core::sampler> sampler = std::make_shared<core::sobol_sampler>();
 
 	void load_gltf(
 			const std::filesystem::path &path);
 
-	void render(const std::filesystem::path &path) const;
+	// Takes a snapshot of the scene first, so changes made to it afterwards are not picked up mid-render
+	void render(const std::filesystem::path &path);
 
 private:
+	struct instance {
+		const scene::model *model;
+		scene::transform transform, inv_transform;
+		math::fmat3 normal_matrix;
+
+		// Index of the first emitter of every surface, or no_emitter if it does not emit light
+		std::vector<uint32_t> first_emitters;
+	};
+
+	// Emissive triangle of an instance, which can be sampled directly
+	struct emitter {
+		uint32_t instance_index;
+		const scene::model::surface *surface;
+		uint32_t triangle_index;
+
+		// In world space
+		float area;
+		math::fvec3 normal;
+	};
+
+	// Point or spot light in world space
+	struct punctual_light {
+		math::fvec3 position;
+		math::fvec3 energy;
+
+		// Spot lights only, a point light has both cosines at -1
+		math::fvec3 direction;
+		float cos_inner_cone_angle, cos_outer_cone_angle;
+	};
+
+	// Flat copy of the scene state needed for tracing, so that the hot path does not touch the scene graph
+	struct render_snapshot {
+		std::vector<instance> instances;
+
+		// Top-level acceleration structure over all model instances
+		core::bvh4 instance_bvh;
+
+		const core::sampler *sampler;
+
+		// Picked in proportion to their power
+		std::vector<emitter> emitters;
+		util::alias_table emitter_table;
+
+		// Picked by how much light they send towards the shading point
+		std::vector<punctual_light> punctual_lights;
+		core::light_bvh light_bvh;
+
+		// Pixels of an environment image picked in proportion to the light they send, empty for other environments
+		util::alias_table environment_table;
+		math::uvec2 environment_size;
+
+		scene::transform camera_transform;
+
+		bool has_sun_light;
+		math::fvec3 sun_direction; // Towards the sun
+		math::fvec3 sun_energy; // Radiance times the solid angle of the disk
+		float sun_angular_radius;
+		float sun_cos_angular_radius;
+		float sun_solid_angle; // 0 for a point-like sun, which bounces cannot hit
+	};
+
+	// Everything it points to is owned by the scene, which outlives the render
 	struct intersect_result {
 		bool hit;
-		std::shared_ptr<core::material> material;
+		const core::material *material;
 
 		math::fvec3 position;
 		math::fvec2 tex_coord;
 		math::fvec3 normal;
 		math::fvec3 tangent;
 
+		uint32_t emitter = no_emitter;
+
 		math::fvec3 get_normal() const;
 	};
 
-	math::fvec4 trace(uint8_t bounce, const geometry::ray &ray) const;
+	render_snapshot snapshot;
+
+	// Path state carried from one vertex to the next, shared by both integrators
+	struct path_state;
+
+	void take_snapshot();
+
+	// Hashes everything that affects the image, except for the number of samples
+	uint64_t get_state_key() const;
+
+	sample_stream get_sample_stream(const math::uvec2 &pixel, uint32_t sample) const;
+
+	geometry::ray get_camera_ray(const math::uvec2 &pixel, sample_stream &stream) const;
+
+	// Returns the number of rays traced
+	uint64_t trace_wavefront(util::thread_pool &pool, uint32_t sample,
+			std::span<const math::uvec2> pixels,
+			const std::function<void(uint32_t, uint32_t, const math::fvec4 &)> &write) const;
+
+	// Shades the vertex the path has hit, queueing the shadow and continuation rays instead of tracing them
+	void shade_path(path_state &path) const;
+
+	// Traces the queued shadow ray and moves the path on to its next vertex, or ends it
+	void advance_path(path_state &path) const;
+
+	math::fvec4 trace(const geometry::ray &ray, sample_stream &stream) const;
+
+	// Continues tracing from an already intersected camera ray, one vertex at a time
+	math::fvec4 shade(const geometry::ray &ray, const intersect_result &result, sample_stream &stream) const;
 
 	intersect_result intersect(const geometry::ray &ray) const;
+
+	// Traces coherent primary rays together, only through BVH meshes
+	std::array<intersect_result, geometry::packet_size> intersect_packet(
+			const geometry::ray_packet &rays, int mask) const;
+
+	// Intensity of the light in the direction of the position, before the falloff with distance
+	math::fvec3 get_punctual_intensity(const punctual_light &light, const math::fvec3 &position) const;
+
+	// Solid angle density of picking the point on the emitter as seen from the origin
+	float get_emitter_pdf(uint32_t index, const math::fvec3 &origin, const math::fvec3 &position) const;
+
+	math::fvec3 get_environment(const math::fvec3 &dir) const;
+
+	// Picks a pixel of the environment image with the first pair and a uniform point in it with the second
+	math::fvec3 sample_environment(const math::fvec2 &rand, const math::fvec2 &point_rand) const;
+
+	// Solid angle density of sample_environment()
+	float get_environment_pdf(const math::fvec3 &dir) const;
+
+	// Fetches the hit's material and interpolates its vertex attributes
+	intersect_result interpolate(const scene::model::intersection &hit, const instance *instance) const;
+
+	// Any-hit query for shadow rays, which skips all attribute interpolation
+	bool occluded(const geometry::ray &ray,
+			float max_distance = std::numeric_limits<float>::max()) const;
 };
 
 }
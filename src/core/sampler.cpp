@@ -0,0 +1,128 @@
+#include "core/sampler.hpp"
+
+using namespace math;
+
+namespace core {
+
+// PCG output permutation applied to an LCG step, a good and cheap 32-bit integer hash
+static uint32_t pcg_hash(uint32_t value) {
+	uint32_t state = value * 747796405U + 2891336453U;
+	uint32_t word = ((state >> ((state >> 28) + 4)) ^ state) * 277803737U;
+	return (word >> 22) ^ word;
+}
+
+// Top 24 bits fit a float exactly, so the result never rounds up to 1
+static float to_unit_float(uint32_t value) {
+	return static_cast<float>(value >> 8) * 0x1p-24F;
+}
+
+random_sampler::random_sampler(uint32_t seed) : seed(seed) {}
+
+float random_sampler::get(uint32_t pixel_index, uint32_t sample_index, uint32_t dimension) const {
+	return to_unit_float(pcg_hash(seed + pcg_hash(pixel_index + pcg_hash(sample_index + pcg_hash(dimension)))));
+}
+
+uint64_t random_sampler::get_key() const {
+	return seed;
+}
+
+// Direction numbers by Joe and Kuo, dimension zero is just the van der Corput sequence
+static constexpr auto sobol_directions = [] {
+	constexpr uint32_t degrees[4] = { 0, 1, 2, 3 };
+	constexpr uint32_t coefficients[4] = { 0, 0, 1, 1 };
+	constexpr uint32_t initial[4][3] = { {}, { 1 }, { 1, 3 }, { 1, 3, 1 } };
+
+	std::array<std::array<uint32_t, 32>, 4> directions{};
+
+	for (uint32_t bit = 0; bit < 32; bit++)
+		directions[0][bit] = 1U << (31 - bit);
+
+	for (uint32_t dimension = 1; dimension < 4; dimension++) {
+		uint32_t degree = degrees[dimension];
+		std::array<uint32_t, 32> &v = directions[dimension];
+
+		for (uint32_t bit = 0; bit < degree; bit++)
+			v[bit] = initial[dimension][bit] << (31 - bit);
+
+		for (uint32_t bit = degree; bit < 32; bit++) {
+			v[bit] = v[bit - degree] ^ (v[bit - degree] >> degree);
+
+			for (uint32_t k = 1; k < degree; k++) {
+				if ((coefficients[dimension] >> (degree - 1 - k)) & 1)
+					v[bit] ^= v[bit - k];
+			}
+		}
+	}
+
+	return directions;
+}();
+
+static uint32_t sobol(uint32_t index, uint32_t dimension) {
+	uint32_t result = 0;
+
+	for (uint32_t bit = 0; index != 0; bit++, index >>= 1) {
+		if (index & 1)
+			result ^= sobol_directions[dimension][bit];
+	}
+
+	return result;
+}
+
+static uint32_t reverse_bits(uint32_t value) {
+	value = ((value >> 1) & 0x55555555U) | ((value & 0x55555555U) << 1);
+	value = ((value >> 2) & 0x33333333U) | ((value & 0x33333333U) << 2);
+	value = ((value >> 4) & 0x0F0F0F0FU) | ((value & 0x0F0F0F0FU) << 4);
+	value = ((value >> 8) & 0x00FF00FFU) | ((value & 0x00FF00FFU) << 8);
+	return (value >> 16) | (value << 16);
+}
+
+// Randomly permutes values such that each bit is flipped based only on the bits above it
+// This is Owen scrambling, as shown in "Practical Hash-based Owen Scrambling" by Brent Burley
+static uint32_t nested_uniform_scramble(uint32_t value, uint32_t seed) {
+	value = reverse_bits(value);
+
+	// Laine-Karras permutation, which only propagates changes towards higher bits
+	value += seed;
+	value ^= value * 0x6c50b47cU;
+	value ^= value * 0xb82f1e52U;
+	value ^= value * 0xc7afe638U;
+	value ^= value * 0x8d22f6e6U;
+
+	return reverse_bits(value);
+}
+
+sobol_sampler::sobol_sampler(uint32_t seed) : seed(seed) {}
+
+float sobol_sampler::get(uint32_t pixel_index, uint32_t sample_index, uint32_t dimension) const {
+	uint32_t group_seed = pcg_hash(seed + pcg_hash(pixel_index + pcg_hash(dimension / 4)));
+
+	// Shuffling the order of the samples keeps the groups from being correlated with each other
+	uint32_t index = nested_uniform_scramble(sample_index, group_seed);
+	uint32_t value = sobol(index, dimension % 4);
+
+	return to_unit_float(nested_uniform_scramble(value, pcg_hash(group_seed + dimension % 4)));
+}
+
+// The upper half tells the sampler types apart
+uint64_t sobol_sampler::get_key() const {
+	return (uint64_t(1) << 32) | seed;
+}
+
+sample_stream::sample_stream(const sampler &source, uint32_t pixel_index, uint32_t sample_index) :
+		source(&source), pixel_index(pixel_index), sample_index(sample_index) {}
+
+void sample_stream::next_vertex() {
+	block_start += block_size;
+	block_size = vertex_dimensions;
+}
+
+float sample_stream::get(uint32_t offset) const {
+	assert(offset < block_size);
+	return source->get(pixel_index, sample_index, block_start + offset);
+}
+
+fvec2 sample_stream::get_2d(uint32_t offset) const {
+	return fvec2(get(offset), get(offset + 1));
+}
+
+}
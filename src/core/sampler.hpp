@@ -0,0 +1,74 @@
+#pragma once
+
+#include "pch.hpp"
+
+#include "math/vec2.hpp"
+
+namespace core {
+
+// Source of sample values for the integrator
+// Values must be pure functions of their arguments, so that images do not depend on the order in which pixels are traced
+class sampler {
+public:
+	virtual ~sampler() {}
+
+	// Returns a value in [0, 1)
+	virtual float get(uint32_t pixel_index, uint32_t sample_index, uint32_t dimension) const = 0;
+
+	// Samplers with equal keys return equal values, so a resumed render can go on with the same one
+	virtual uint64_t get_key() const = 0;
+};
+
+// Independent uniform values hashed from the sample coordinates
+class random_sampler : public sampler {
+public:
+	uint32_t seed;
+
+	random_sampler(uint32_t seed = 0);
+
+	float get(uint32_t pixel_index, uint32_t sample_index, uint32_t dimension) const override;
+
+	uint64_t get_key() const override;
+};
+
+// The first four Sobol dimensions with hash-based Owen scrambling, decorrelated per pixel
+// Every following group of four dimensions reuses them with its own index shuffle and scrambling
+class sobol_sampler : public sampler {
+public:
+	uint32_t seed;
+
+	sobol_sampler(uint32_t seed = 0);
+
+	float get(uint32_t pixel_index, uint32_t sample_index, uint32_t dimension) const override;
+
+	uint64_t get_key() const override;
+};
+
+// Hands out the dimensions of a single pixel sample
+// Each path vertex gets a block of its own, so that all samples of a pixel use the same dimension for the same decision
+class sample_stream {
+public:
+	static constexpr uint32_t camera_dimensions = 4;
+	static constexpr uint32_t vertex_dimensions = 16;
+
+	sample_stream() = default;
+
+	sample_stream(const sampler &source, uint32_t pixel_index, uint32_t sample_index);
+
+	// Moves from the camera block or the current vertex block to the next vertex
+	void next_vertex();
+
+	// Offset is relative to the current block
+	float get(uint32_t offset) const;
+
+	math::fvec2 get_2d(uint32_t offset) const;
+
+private:
+	const sampler *source = nullptr;
+	uint32_t pixel_index = 0;
+	uint32_t sample_index = 0;
+	uint32_t block_start = 0;
+	uint32_t block_size = camera_dimensions;
+};
+
+}
@@ -27,7 +27,7 @@ void aabb::add(const aabb &aabb) {
 
 void aabb::clear() {
 	min = fvec3(std::numeric_limits<float>::max());
-	max = fvec3(std::numeric_limits<float>::min());
+	max = fvec3(std::numeric_limits<float>::lowest());
 }
 
 float aabb::get_surface_area() const {
@@ -37,6 +37,22 @@ float aabb::get_surface_area() const {
 			widths.x * widths.z) * 2;
 }
 
+aabb aabb::transform(const scene::transform &transform) const {
+	geometry::aabb aabb;
+	aabb.clear();
+
+	// Bound all eight transformed corners
+	for (uint8_t i = 0; i < 8; i++) {
+		aabb.add(transform * fvec3(
+			(i & 1) ? max.x : min.x,
+			(i & 2) ? max.y : min.y,
+			(i & 4) ? max.z : min.z
+		));
+	}
+
+	return aabb;
+}
+
 aabb::intersection aabb::intersect(const ray &ray) const {
 	if (any(min > max))
 		return {};
@@ -26,6 +26,8 @@ struct aabb {
 
 	float get_surface_area() const;
 
+	aabb transform(const scene::transform &transform) const;
+
 	intersection intersect(const ray &ray) const;
 };
 
@@ -9,6 +9,8 @@ class ray {
 public:
 	math::fvec3 origin;
 
+	ray() = default;
+
 	ray(const math::fvec3 &origin, const math::fvec3 &dir);
 
 	ray transform(const scene::transform &transform) const;
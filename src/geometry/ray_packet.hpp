@@ -0,0 +1,16 @@
+#pragma once
+
+#include "pch.hpp"
+
+#include "geometry/ray.hpp"
+
+namespace geometry {
+
+// Coherent rays traced together, one per SSE lane
+// Lanes are enabled by bits of an accompanying mask
+static constexpr uint8_t packet_size = 4;
+static constexpr int full_packet_mask = (1 << packet_size) - 1;
+
+using ray_packet = std::array<ray, packet_size>;
+
+}
@@ -15,6 +15,8 @@ struct triangle {
 
 	math::fvec3 a, b, c;
 
+	triangle() = default;
+
 	triangle(const math::fvec3 &a,
 			 const math::fvec3 &b,
 			 const math::fvec3 &c);
@@ -119,4 +119,8 @@ bool image::is_srgb() const {
 	return srgb;
 }
 
+std::span<const uint8_t> image::get_data() const {
+	return data;
+}
+
 }
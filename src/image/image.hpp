@@ -26,6 +26,9 @@ public:
 
 	bool is_srgb() const;
 
+	// Raw pixel data, floats for HDR images and bytes otherwise
+	std::span<const uint8_t> get_data() const;
+
 private:
 	math::uvec2 size;
 	uint32_t channel_count;
@@ -40,6 +40,10 @@ fvec4 image_texture::sample(const fvec2 &coord) const {
 	return lerp(t, b, delta.y);
 }
 
+const std::shared_ptr<image> &image_texture::get_image() const {
+	return img;
+}
+
 fvec4 image_texture::read_pixel(const uvec2 &pixel) const {
 	fvec4 color = fvec4::one;
 
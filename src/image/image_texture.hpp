@@ -17,6 +17,8 @@ public:
 
 	math::fvec4 sample(const math::fvec2 &coord) const override; 
 
+	const std::shared_ptr<image> &get_image() const;
+
 private:
 	std::shared_ptr<image> img;
 
@@ -33,6 +33,8 @@ int main() {
 	// renderer.environment_factor = fvec3(3);
 	renderer.transparent_background = true;
 
+	renderer.accelerator_cache_directory = "cache";
+
 	// renderer.camera_index = 1;
 	// renderer.sun_light_index = 0;
 
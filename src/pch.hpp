@@ -3,23 +3,28 @@
 #include <algorithm>
 #include <array>
 #include <atomic>
+#include <bit>
 #include <cassert>
+#include <chrono>
 #include <cmath>
 #include <concepts>
 #include <cstdint>
 #include <cstring>
 #include <execution>
 #include <filesystem>
+#include <fstream>
 #include <functional>
 #include <future>
 #include <iomanip>
 #include <iostream>
 #include <memory>
+#include <memory_resource>
 #include <numbers>
 #include <numeric>
 #include <queue>
 #include <random>
 #include <regex>
+#include <span>
 #include <sstream>
 #include <stack>
 #include <stdexcept>
@@ -30,6 +35,8 @@
 #include <unordered_map>
 #include <vector>
 
+#include <immintrin.h>
+
 #include <assimp/Importer.hpp>
 #include <assimp/pbrmaterial.h>
 #include <assimp/postprocess.h>
@@ -8,7 +8,7 @@ using namespace math;
 
 namespace scene {
 
-ray camera::get_ray(const fvec2 &ndc, float ratio) const {
+ray camera::get_ray(const fvec2 &ndc, float ratio, const scene::transform &transform) const {
 	fvec2 dir = tan_half_fov * ndc;
 	dir.x *= ratio;
 
@@ -18,8 +18,7 @@ ray camera::get_ray(const fvec2 &ndc, float ratio) const {
 		fvec3(dir.x, dir.y, -1)
 	);
 
-	return ray.transform(get_entity()
-			->get_global_transform());
+	return ray.transform(transform);
 }
 
 float camera::get_fov() const {
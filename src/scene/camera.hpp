@@ -3,12 +3,14 @@
 #include "geometry/ray.hpp"
 #include "math/vec2.hpp"
 #include "scene/component.hpp"
+#include "scene/transform.hpp"
 
 namespace scene {
 
 class camera : public component {
 public:
-	geometry::ray get_ray(const math::fvec2 &ndc, float ratio) const;
+	// Transform is passed in, so that it can be taken from a snapshot of the scene
+	geometry::ray get_ray(const math::fvec2 &ndc, float ratio, const scene::transform &transform) const;
 
 	float get_fov() const;
 
@@ -19,12 +19,10 @@ void model::recalculate_aabb() {
 }
 
 model::intersection model::intersect(
-		const ray &ray, uint8_t visualize_kd_tree_depth) const {
-	scene::transform transform = get_entity()->
-			get_global_transform();
-	scene::transform inv_transform
-			= transform.inverse();
-
+		const ray &ray,
+		const scene::transform &transform,
+		const scene::transform &inv_transform,
+		uint8_t visualize_kd_tree_depth) const {
 	// Transform ray from world space to local space
 	// This method leaves the length of the ray normalized
 	auto view_ray = ray.transform(inv_transform);
@@ -65,11 +63,84 @@ model::intersection model::intersect(
 
 	return {
 		nearest_hit.distance,
-		transform,
 		hit_surface,
 		nearest_hit.index,
 		nearest_hit.barycentric
 	};
 }
 
+std::array<model::intersection, packet_size> model::intersect_packet(
+		const ray_packet &rays,
+		const scene::transform &transform,
+		const scene::transform &inv_transform,
+		int mask) const {
+	ray_packet view_rays = rays;
+
+	for (uint8_t i = 0; i < packet_size; i++) {
+		if (!(mask & (1 << i)))
+			continue;
+
+		view_rays[i] = rays[i].transform(inv_transform);
+
+		if (!aabb.intersect(view_rays[i]).has_hit())
+			mask &= ~(1 << i);
+	}
+
+	std::array<intersection, packet_size> nearest_hits;
+
+	if (mask == 0)
+		return nearest_hits;
+
+	for (const auto &surface : surfaces) {
+		auto hits = surface.mesh->intersect_packet(view_rays, mask);
+
+		for (uint8_t i = 0; i < packet_size; i++) {
+			if (!(mask & (1 << i)) || !hits[i].has_hit())
+				continue;
+
+			// Distances are compared in local space and transformed once the nearest hit is known
+			if (hits[i].distance < nearest_hits[i].distance
+					|| !nearest_hits[i].has_hit()) {
+				nearest_hits[i] = {
+					hits[i].distance,
+					&surface,
+					hits[i].index,
+					hits[i].barycentric
+				};
+			}
+		}
+	}
+
+	for (uint8_t i = 0; i < packet_size; i++) {
+		if (!nearest_hits[i].has_hit())
+			continue;
+
+		fvec3 hit_vec = view_rays[i].get_dir() * nearest_hits[i].distance;
+		nearest_hits[i].distance = length(transform.basis * hit_vec);
+	}
+
+	return nearest_hits;
+}
+
+bool model::occluded(
+		const ray &ray,
+		const scene::transform &transform,
+		const scene::transform &inv_transform,
+		float max_distance) const {
+	auto view_ray = ray.transform(inv_transform);
+
+	if (!aabb.intersect(view_ray).has_hit())
+		return false;
+
+	// Transform max distance from world space to local space, inverse of what intersect does to hit distances
+	max_distance /= length(transform.basis * view_ray.get_dir());
+
+	for (const auto &surface : surfaces) {
+		if (surface.mesh->occluded(view_ray, max_distance))
+			return true;
+	}
+
+	return false;
+}
+
 };
@@ -6,6 +6,7 @@
 #include "core/mesh.hpp"
 #include "geometry/aabb.hpp"
 #include "geometry/ray.hpp"
+#include "geometry/ray_packet.hpp"
 #include "scene/component.hpp"
 #include "scene/transform.hpp"
 
@@ -20,7 +21,6 @@ public:
 
 	struct intersection {
 		float distance = -1;
-		scene::transform transform;
 		const model::surface *surface;
 		uint32_t triangle_index;
 		math::fvec3 barycentric;
@@ -33,7 +33,25 @@ public:
 
 	void recalculate_aabb();
 
-	intersection intersect(const geometry::ray &ray, uint8_t visualize_kd_tree_depth = 0) const;
+	// Transforms are passed in so that they can be precomputed for every instance
+	intersection intersect(
+			const geometry::ray &ray,
+			const scene::transform &transform,
+			const scene::transform &inv_transform,
+			uint8_t visualize_kd_tree_depth = 0) const;
+
+	std::array<intersection, geometry::packet_size> intersect_packet(
+			const geometry::ray_packet &rays,
+			const scene::transform &transform,
+			const scene::transform &inv_transform,
+			int mask) const;
+
+	// Max distance is given in world space
+	bool occluded(
+			const geometry::ray &ray,
+			const scene::transform &transform,
+			const scene::transform &inv_transform,
+			float max_distance) const;
 };
 
 }
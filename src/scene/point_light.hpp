@@ -0,0 +1,14 @@
+#pragma once
+
+#include "../math/vec3.hpp"
+#include "component.hpp"
+
+namespace scene {
+
+// Shines equally in all directions from the origin of its entity
+class point_light : public component {
+public:
+	math::fvec3 energy = math::fvec3(100); // Radiant intensity, falls off with the squared distance
+};
+
+}
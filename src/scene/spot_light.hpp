@@ -0,0 +1,16 @@
+#pragma once
+
+#include "../math/vec3.hpp"
+#include "component.hpp"
+
+namespace scene {
+
+// Point light limited to a cone along the forward axis of its entity
+class spot_light : public component {
+public:
+	math::fvec3 energy = math::fvec3(100); // Radiant intensity on the axis
+	float inner_cone_angle = 0; // In radians, full intensity up to here
+	float outer_cone_angle = 0.785398; // In radians, no light past here
+};
+
+}
@@ -0,0 +1,60 @@
+#include "util/alias_table.hpp"
+
+namespace util {
+
+alias_table::alias_table(const std::vector<float> &weights) {
+	double total = std::accumulate(weights.begin(), weights.end(), 0.0);
+
+	if (total <= 0)
+		return;
+
+	uint32_t count = weights.size();
+
+	probabilities.resize(count);
+	bins.resize(count);
+
+	// Bins are filled up to the average weight, taking the excess of heavy ones
+	std::vector<double> scaled(count);
+	std::vector<uint32_t> small, large;
+
+	for (uint32_t i = 0; i < count; i++) {
+		probabilities[i] = weights[i] / total;
+		scaled[i] = weights[i] / total * count;
+		(scaled[i] < 1 ? small : large).push_back(i);
+	}
+
+	while (!small.empty() && !large.empty()) {
+		uint32_t light = small.back();
+		uint32_t heavy = large.back();
+		small.pop_back();
+
+		bins[light] = { static_cast<float>(scaled[light]), heavy };
+
+		scaled[heavy] -= 1 - scaled[light];
+		if (scaled[heavy] < 1) {
+			large.pop_back();
+			small.push_back(heavy);
+		}
+	}
+
+	// Whatever is left is full up to rounding errors
+	for (uint32_t i : small)
+		bins[i] = { 1, i };
+	for (uint32_t i : large)
+		bins[i] = { 1, i };
+}
+
+uint32_t alias_table::sample(float rand, float alias_rand) const {
+	uint32_t index = std::min(static_cast<uint32_t>(rand * bins.size()), static_cast<uint32_t>(bins.size() - 1));
+	return alias_rand < bins[index].threshold ? index : bins[index].alias;
+}
+
+float alias_table::get_probability(uint32_t index) const {
+	return probabilities[index];
+}
+
+bool alias_table::empty() const {
+	return bins.empty();
+}
+
+}
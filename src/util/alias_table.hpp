@@ -0,0 +1,33 @@
+#pragma once
+
+#include "pch.hpp"
+
+namespace util {
+
+// Picks indices in proportion to their weights in constant time (Vose's alias method)
+class alias_table {
+public:
+	alias_table() = default;
+
+	// Empty if all weights are zero
+	alias_table(const std::vector<float> &weights);
+
+	// Expects values in [0, 1), the second one chooses between a bin and its alias
+	// It must be drawn separately, because the fraction left over from picking one of many bins has too few bits
+	uint32_t sample(float rand, float alias_rand) const;
+
+	float get_probability(uint32_t index) const;
+
+	bool empty() const;
+
+private:
+	struct bin {
+		float threshold; // Probability of keeping the bin's own index
+		uint32_t alias;
+	};
+
+	std::vector<bin> bins;
+	std::vector<float> probabilities;
+};
+
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "pch.hpp"
+
+namespace util {
+
+// Standard allocator that aligns every allocation, e.g. to cache lines
+template<typename T, size_t Alignment>
+class aligned_allocator {
+public:
+	using value_type = T;
+
+	template<typename U>
+	struct rebind {
+		using other = aligned_allocator<U, Alignment>;
+	};
+
+	aligned_allocator() = default;
+
+	template<typename U>
+	aligned_allocator(const aligned_allocator<U, Alignment> &other);
+
+	T *allocate(size_t count);
+
+	void deallocate(T *pointer, size_t count);
+
+	template<typename U>
+	bool operator==(const aligned_allocator<U, Alignment> &other) const;
+};
+
+}
+
+#include "aligned_allocator.inl"
@@ -0,0 +1,23 @@
+namespace util {
+
+template<typename T, size_t Alignment>
+template<typename U>
+aligned_allocator<T, Alignment>::aligned_allocator(const aligned_allocator<U, Alignment> &other) {}
+
+template<typename T, size_t Alignment>
+T *aligned_allocator<T, Alignment>::allocate(size_t count) {
+	return static_cast<T *>(::operator new(count * sizeof(T), std::align_val_t(Alignment)));
+}
+
+template<typename T, size_t Alignment>
+void aligned_allocator<T, Alignment>::deallocate(T *pointer, size_t count) {
+	::operator delete(pointer, count * sizeof(T), std::align_val_t(Alignment));
+}
+
+template<typename T, size_t Alignment>
+template<typename U>
+bool aligned_allocator<T, Alignment>::operator==(const aligned_allocator<U, Alignment> &other) const {
+	return true;
+}
+
+}
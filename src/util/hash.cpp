@@ -0,0 +1,26 @@
+#include "util/hash.hpp"
+
+namespace util {
+
+// FNV-1a consuming eight bytes at a time, with the high bits folded back in after every step
+uint64_t hash(const void *data, size_t size, uint64_t seed) {
+	static constexpr uint64_t prime = 0x100000001b3;
+
+	const auto *bytes = static_cast<const uint8_t *>(data);
+	uint64_t hash = seed;
+
+	for (; size >= 8; bytes += 8, size -= 8) {
+		uint64_t word;
+		std::memcpy(&word, bytes, 8);
+
+		hash = (hash ^ word) * prime;
+		hash ^= hash >> 32;
+	}
+
+	for (; size > 0; bytes++, size--)
+		hash = (hash ^ *bytes) * prime;
+
+	return hash;
+}
+
+}
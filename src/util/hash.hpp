@@ -0,0 +1,10 @@
+#pragma once
+
+#include "pch.hpp"
+
+namespace util {
+
+// Non-cryptographic 64-bit hash, chain calls by passing the previous result as the seed
+uint64_t hash(const void *data, size_t size, uint64_t seed = 0xcbf29ce484222325);
+
+}
@@ -0,0 +1,100 @@
+#include "util/mapped_file.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace util {
+
+#ifdef _WIN32
+
+mapped_file::mapped_file(const std::filesystem::path &path) {
+	file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+			nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		file = nullptr;
+		throw std::runtime_error("Failed to open " + path.string() + ".");
+	}
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size)) {
+		CloseHandle(file);
+		throw std::runtime_error("Failed to query the size of " + path.string() + ".");
+	}
+	size = static_cast<size_t>(file_size.QuadPart);
+
+	// Empty files cannot be mapped
+	if (size == 0)
+		return;
+
+	mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping)
+		data = static_cast<const std::byte *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+
+	if (!data) {
+		if (mapping)
+			CloseHandle(mapping);
+		CloseHandle(file);
+		throw std::runtime_error("Failed to map " + path.string() + ".");
+	}
+}
+
+mapped_file::~mapped_file() {
+	if (data)
+		UnmapViewOfFile(data);
+	if (mapping)
+		CloseHandle(mapping);
+	if (file)
+		CloseHandle(file);
+}
+
+#else
+
+mapped_file::mapped_file(const std::filesystem::path &path) {
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw std::runtime_error("Failed to open " + path.string() + ".");
+
+	struct stat file_stat;
+	if (fstat(fd, &file_stat) != 0) {
+		close(fd);
+		throw std::runtime_error("Failed to query the size of " + path.string() + ".");
+	}
+	size = static_cast<size_t>(file_stat.st_size);
+
+	// Empty files cannot be mapped
+	if (size == 0) {
+		close(fd);
+		return;
+	}
+
+	void *address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	// The mapping keeps its own reference to the file
+	close(fd);
+
+	if (address == MAP_FAILED)
+		throw std::runtime_error("Failed to map " + path.string() + ".");
+
+	data = static_cast<const std::byte *>(address);
+}
+
+mapped_file::~mapped_file() {
+	if (data)
+		munmap(const_cast<std::byte *>(data), size);
+}
+
+#endif
+
+std::span<const std::byte> mapped_file::get_data() const {
+	return { data, size };
+}
+
+}
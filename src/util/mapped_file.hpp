@@ -0,0 +1,30 @@
+#pragma once
+
+#include "pch.hpp"
+
+namespace util {
+
+// Read-only view of a whole file, paged in by the OS on demand
+class mapped_file {
+public:
+	mapped_file(const std::filesystem::path &path);
+
+	mapped_file(const mapped_file &) = delete;
+
+	mapped_file &operator=(const mapped_file &) = delete;
+
+	~mapped_file();
+
+	std::span<const std::byte> get_data() const;
+
+private:
+	const std::byte *data = nullptr;
+	size_t size = 0;
+
+#ifdef _WIN32
+	void *file = nullptr;
+	void *mapping = nullptr;
+#endif
+};
+
+}
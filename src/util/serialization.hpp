@@ -0,0 +1,25 @@
+#pragma once
+
+#include "pch.hpp"
+
+namespace util {
+
+// Raw binary I/O of trivially copyable data, meant for caches read back by the same build
+
+template<typename T>
+void write_value(std::ostream &stream, const T &value);
+
+// The element count comes first
+template<typename T, typename Allocator>
+void write_array(std::ostream &stream, const std::vector<T, Allocator> &array);
+
+// Advances data past what was read, throws if it is truncated
+template<typename T>
+void read_value(std::span<const std::byte> &data, T &value);
+
+template<typename T, typename Allocator>
+void read_array(std::span<const std::byte> &data, std::vector<T, Allocator> &array);
+
+}
+
+#include "serialization.inl"
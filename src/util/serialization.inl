@@ -0,0 +1,45 @@
+namespace util {
+
+template<typename T>
+void write_value(std::ostream &stream, const T &value) {
+	static_assert(std::is_trivially_copyable_v<T>);
+
+	stream.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template<typename T, typename Allocator>
+void write_array(std::ostream &stream, const std::vector<T, Allocator> &array) {
+	static_assert(std::is_trivially_copyable_v<T>);
+
+	write_value(stream, static_cast<uint64_t>(array.size()));
+	stream.write(reinterpret_cast<const char *>(array.data()), array.size() * sizeof(T));
+}
+
+template<typename T>
+void read_value(std::span<const std::byte> &data, T &value) {
+	static_assert(std::is_trivially_copyable_v<T>);
+
+	if (data.size() < sizeof(T))
+		throw std::runtime_error("Data is truncated.");
+
+	std::memcpy(&value, data.data(), sizeof(T));
+	data = data.subspan(sizeof(T));
+}
+
+template<typename T, typename Allocator>
+void read_array(std::span<const std::byte> &data, std::vector<T, Allocator> &array) {
+	static_assert(std::is_trivially_copyable_v<T>);
+
+	uint64_t size;
+	read_value(data, size);
+
+	if (size > data.size() / sizeof(T))
+		throw std::runtime_error("Data is truncated.");
+
+	// Elements are copied as they are, the mapping may not be aligned for T
+	array.resize(size);
+	std::memcpy(array.data(), data.data(), size * sizeof(T));
+	data = data.subspan(size * sizeof(T));
+}
+
+}
@@ -23,7 +23,11 @@ thread_pool::thread_pool(uint32_t thread_count) {
 
 thread_pool::~thread_pool() {
 	// Threads will exit as soon as there is no more work to pick up
-	terminating.test_and_set();
+	// The flag is set under the lock, so that a thread about to sleep cannot miss it
+	{
+		std::unique_lock lock(queue_mutex);
+		terminating.test_and_set();
+	}
 	notifier.notify_all();
 
 	// Wait for threads that still might be processing
@@ -43,6 +47,21 @@ std::shared_ptr<future> thread_pool::submit(std::function<void(uint32_t)> job) {
 	return future;
 }
 
+void thread_pool::parallel_for(uint32_t count, const std::function<void(uint32_t)> &job) {
+	std::vector<std::shared_ptr<future>> todo;
+	todo.reserve(count);
+
+	for (uint32_t i = 0; i < count; i++)
+		todo.push_back(submit([&job, i] (uint32_t) { job(i); }));
+
+	// Every job must finish before we rethrow, because they all reference the same callable
+	for (auto &future : todo)
+		future->wait();
+
+	for (auto &future : todo)
+		future->rethrow();
+}
+
 uint32_t thread_pool::thread_count() const {
 	return threads.size();
 }
@@ -77,7 +96,12 @@ void thread_pool::process(uint32_t thread_index, const future *quit_when_ready)
 			future->exception = std::current_exception();
 		}
 		
-		future->_ready.test_and_set();
+		// Set under the lock, otherwise a worker waiting on this future could check it
+		// right before it is set and then sleep through the notification
+		{
+			std::unique_lock lock(queue_mutex);
+			future->_ready.test_and_set();
+		}
 		future->_ready.notify_all();
 
 		// This is needed so that quit_when_ready futures can be checked again
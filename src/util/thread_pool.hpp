@@ -18,6 +18,10 @@ public:
 
 	std::shared_ptr<future> submit(std::function<void(uint32_t)> job);
 
+	// Runs job(index) for every index in [0, count) and waits for all of them
+	// Safe to call from within jobs of the same pool
+	void parallel_for(uint32_t count, const std::function<void(uint32_t)> &job);
+
 	uint32_t thread_count() const;
 
 private: